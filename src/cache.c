@@ -5,6 +5,10 @@
 
 #include "temu.h"
 
+#include <asm/unistd.h>
+#include <linux/memfd.h>
+#include <linux/perf_event.h>
+
 #define sys_icache_invalidate(addr, size) \
   __builtin___clear_cache((char *)(addr), (char *)(addr) + (size));
 
@@ -15,17 +19,118 @@ static u64 hash(u64 pc) {
     return pc % CACHE_ENTRY_SIZE;
 }
 
+/// @brief 预留 size 字节 PROT_NONE 的地址空间：起点按大页对齐，大页才能映射进来
+/// @return 起点：失败时为 MAP_FAILED
+static u8 *cache_reserve(u64 size) {
+    u64 len = size + CACHE_HUGEPAGE_SIZE;
+    u8 *raw = mmap(NULL, len, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return raw;
+    u8 *base = (u8 *)ROUNDUP((u64)raw, CACHE_HUGEPAGE_SIZE);
+    if (base > raw) munmap(raw, base - raw);
+    munmap(base + size, raw + len - (base + size));
+    return base;
+}
+
+/**
+ * W^X：同一个 memfd 映射两次，可执行视图只读，写入都经过可写视图。
+ * 两个视图放在同一段预留区里，相距 CACHE_SIZE，JIT 代码可以 PC32 寻址可写视图中的数据。
+ * @param flags memfd_create 的额外标志：MFD_HUGETLB 时由 hugetlbfs 提供大页，没有预留大页时失败
+ */
+static bool cache_map_memfd(cache_t *cache, unsigned int flags) {
+    u8 *base = cache_reserve(2 * CACHE_SIZE);
+    if (base == MAP_FAILED) return false;
+    int fd = syscall(__NR_memfd_create, "temu-jit", MFD_CLOEXEC | flags);
+    if (fd >= 0 && ftruncate(fd, CACHE_SIZE) == 0) {
+        u8 *rx = mmap(base, CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED | MAP_FIXED, fd, 0);
+        u8 *rw = mmap(base + CACHE_SIZE, CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0);
+        if (rx != MAP_FAILED && rw != MAP_FAILED) {
+            close(fd);
+            cache->jitcode = rx;
+            cache->jitcode_rw = rw;
+            cache->pages = flags & MFD_HUGETLB ? "hugetlb" : "4k";
+            return true;
+        }
+    }
+    if (fd >= 0) close(fd);
+    munmap(base, 2 * CACHE_SIZE);
+    return false;
+}
+
+/// @brief 打开用户态 iTLB 读缺失计数器：内核不允许时返回 -1
+static int cache_itlb_open(void) {
+    struct perf_event_attr attr = {0};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_ITLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+/**
+ * 依次尝试 hugetlbfs 大页（CACHE_HUGETLB 时）、普通 memfd 与可读可写可执行的匿名映射。
+ * 后两种在 CACHE_HUGEPAGE 时提示内核使用透明大页：
+ * 代码写入前给出提示，之后缺页时按 2MB 分配，代码块之间跳转不再频繁缺失 iTLB。
+ */
 cache_t *new_cache() {
     cache_t *cache = (cache_t *)calloc(1, sizeof(cache_t));
-    cache->jitcode = (u8 *)mmap(NULL, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
-                          MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    cache->cold = CACHE_SIZE - CACHE_COLD_SIZE;
+    cache->itlb_fd = TEMU_STATS ? cache_itlb_open() : -1;
+
+    if (CACHE_HUGETLB && cache_map_memfd(cache, MFD_HUGETLB | MFD_HUGE_2MB)) return cache;
+    if (!cache_map_memfd(cache, 0)) {
+        u8 *base = cache_reserve(CACHE_SIZE);
+        if (base == MAP_FAILED) fatal(strerror(errno));
+        cache->jitcode = (u8 *)mmap(base, CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                                    MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+        if (cache->jitcode == MAP_FAILED) fatal(strerror(errno));
+        cache->jitcode_rw = cache->jitcode;
+        cache->pages = "4k";
+    }
+    // 共享内存的透明大页还需要 shmem_enabled 允许 advise，否则提示无效，仍是 4k 页
+    if (CACHE_HUGEPAGE && madvise(cache->jitcode, CACHE_SIZE, MADV_HUGEPAGE) == 0) {
+        if (cache->jitcode_rw != cache->jitcode) madvise(cache->jitcode_rw, CACHE_SIZE, MADV_HUGEPAGE);
+        cache->pages = "thp";
+    }
     return cache;
 }
 
+/// @brief 可执行视图中实际由大页映射的大小：提示只是请求，内核不一定照办
+/// @return KB 数
+static u64 cache_huge_kb(cache_t *cache) {
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (!fp) return 0;
+    char line[256], perms[8];
+    u64 lo, hi, kb = 0, val;
+    bool in = false;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%lx-%lx %7s", &lo, &hi, perms) == 3) in = lo == (u64)cache->jitcode;
+        else if (in && (sscanf(line, "AnonHugePages: %lu", &val) == 1 ||
+                        sscanf(line, "ShmemPmdMapped: %lu", &val) == 1 ||
+                        sscanf(line, "Shared_Hugetlb: %lu", &val) == 1))
+            kb += val;
+    }
+    fclose(fp);
+    return kb;
+}
+
+void cache_report(cache_t *cache) {
+    u64 used = cache->offset + cache->cold - (CACHE_SIZE - CACHE_COLD_SIZE);
+    fprintf(stderr, "cache: %s pages, %lu KB used, %lu KB huge-mapped\n",
+            cache->pages, used / 1024, cache_huge_kb(cache));
+    u64 misses;
+    if (cache->itlb_fd >= 0 && read(cache->itlb_fd, &misses, sizeof(misses)) == sizeof(misses))
+        fprintf(stderr, "cache: %lu iTLB misses\n", misses);
+}
+
 #define MAX_SEARCH_COUNT 32
 /// 只有一个代码块被反复执行 10000 次才被认为是 hot 代码
 #define CACHE_HOT_COUNT  100000
 
+/// 执行次数达到该值的代码块在编译热代码块时一并编译
+#define CACHE_WARM_COUNT (CACHE_HOT_COUNT / 10)
+
 /// 宏：判断是否热代码块
 #define CACHE_IS_HOT (cache->table[index].hot >= CACHE_HOT_COUNT)
 
@@ -58,30 +163,38 @@ static inline u64 align_to(u64 val, u64 align) {
 }
 
 
-u8 *cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align) {
-    cache->offset = align_to(cache->offset, align);
-    assert(cache->offset + sz <= CACHE_SIZE);
+/// @brief 从 *offset 开始分配：不超过 limit
+static u8 *cache_alloc_at(cache_t *cache, u64 *offset, u64 limit, u8 *data, size_t sz, u64 align) {
+    *offset = align_to(*offset, align);
+    if (*offset + sz > limit) fatal("jit: code cache is full");
 
-    u64 index = hash(pc);
-    u64 search_count = 0;
-    while (cache->table[index].pc != 0) {
-        if (cache->table[index].pc == pc) {
-            break;
-        }
+    u8 *addr = cache->jitcode + *offset;
+    if (data) memcpy(cache_rw(cache, addr), data, sz);
+    else memset(cache_rw(cache, addr), 0, sz);
+    *offset += sz;          // 更新 cache 偏移量
+    return addr;
+}
 
-        index++;
-        index = hash(index);
+/**
+ * 热区从头开始，冷区在末尾的 CACHE_COLD_SIZE 中：
+ * 冷代码与数据不夹在热代码之间，相关代码块的热代码在一起，少占 icache 行与页
+ */
+u8 *cache_alloc(cache_t *cache, u8 *data, size_t sz, u64 align) {
+    u64 limit = CACHE_SPLIT ? CACHE_SIZE - CACHE_COLD_SIZE : CACHE_SIZE;
+    return cache_alloc_at(cache, &cache->offset, limit, data, sz, align);
+}
 
-        assert(++search_count <= MAX_SEARCH_COUNT);
-    }
+u8 *cache_alloc_cold(cache_t *cache, u8 *data, size_t sz, u64 align) {
+    if (!CACHE_SPLIT) return cache_alloc(cache, data, sz, align);
+    return cache_alloc_at(cache, &cache->cold, CACHE_SIZE, data, sz, align);
+}
 
-    memcpy(cache->jitcode + cache->offset, code, sz);
-    cache->table[index].pc = pc;
-    cache->table[index].offset = cache->offset;
-    cache->offset += sz;    // 更新 cache 偏移量
+u8 *cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align) {
+    u8 *addr = cache_alloc(cache, code, sz, align);
+    cache_set(cache, pc, addr);
     // 内存地址的 icache 刷新：arm, riscv
-    sys_icache_invalidate(cache->jitcode + cache->table[index].offset, sz); 
-    return cache->jitcode + cache->table[index].offset;
+    sys_icache_invalidate(addr, sz);
+    return addr;
 }
 
 bool cache_hot(cache_t *cache, u64 pc) {
@@ -102,4 +215,38 @@ bool cache_hot(cache_t *cache, u64 pc) {
     cache->table[index].pc = pc;
     cache->table[index].hot = 1;
     return false;
-}
\ No newline at end of file
+}
+void cache_set(cache_t *cache, u64 pc, u8 *code) {
+    u64 index = hash(pc);
+    u64 search_count = 0;
+    while (cache->table[index].pc != 0 && cache->table[index].pc != pc) {
+        index++;
+        index = hash(index);
+
+        assert(++search_count <= MAX_SEARCH_COUNT);
+    }
+
+    cache->table[index].pc = pc;
+    cache->table[index].hot = CACHE_HOT_COUNT;
+    cache->table[index].offset = code - cache->jitcode;
+}
+
+u64 cache_count(cache_t *cache, u64 pc) {
+    u64 index = hash(pc);
+    while (cache->table[index].pc != 0) {
+        if (cache->table[index].pc == pc) return cache->table[index].hot;
+        index++;
+        index = hash(index);
+    }
+    return 0;
+}
+
+u64 cache_warm(cache_t *cache, u64 *pcs, u64 max) {
+    u64 n = 0;
+    for (u64 index = 0; index < CACHE_ENTRY_SIZE && n < max; index++) {
+        cache_item_t *item = &cache->table[index];
+        if (item->pc != 0 && item->hot >= CACHE_WARM_COUNT && item->hot < CACHE_HOT_COUNT)
+            pcs[n++] = item->pc;
+    }
+    return n;
+}
@@ -8,6 +8,8 @@
 typedef struct {
     bool gp_reg[num_gp_regs];
     bool fp_reg[num_fp_regs];
+    u64 a7_pc;      // 在该 pc 处 a7 为已知常量：由 IR 的常量折叠给出
+    i64 a7_val;     // a7 的常量值
 } tracer_t;
 
 static void tracer_reset(tracer_t *t) {
@@ -63,9 +65,23 @@ static str_t tracer_append_epilogue(tracer_t *t, str_t s) {
     return s;
 }
 
-static char funcbuf[128] = {0};
+/// funcbuf2 存放表达式，再拼进 funcbuf 的一行代码：funcbuf 要放得下整个 funcbuf2 与格式中的其余文字
+static char funcbuf[256] = {0};
 static char funcbuf2[128] = {0};
 
+/// 正在生成的最内层循环：最内层的回边写成 continue，外层的回边 goto 到 for 之前的循环头
+static bool loop_open = false;
+static u64 loop_pc = 0;
+static bool loop_latch = false;     // 正在生成的指令是最内层的回边起点
+
+/// @brief 跳到 pc 处指令的语句
+static const char *goto_stmt(u64 pc) {
+    static char buf[32];
+    if (loop_open && loop_latch && pc == loop_pc) return "continue";
+    sprintf(buf, "goto insn_%lx", pc);
+    return buf;
+}
+
 #define REG_SET_VAL(reg, val)                                 \
     if ((reg) != 0) {                                         \
         sprintf(funcbuf, "    x%d = %ldLL;\n", (reg), (val)); \
@@ -95,14 +111,14 @@ static char funcbuf2[128] = {0};
     s = str_append(s, funcbuf);                                            \
 
 #define MEM_LOAD(addr, typ, name)                                                       \
-    sprintf(funcbuf, "    %s " #name " = *(%s *)TO_HOST(%s);\n", (typ), (typ), (addr)); \
+    sprintf(funcbuf, "    %s " #name " = *(guest_%s *)TO_HOST(%s);\n", (typ), (typ), (addr)); \
     s = str_append(s, funcbuf);                                                         \
 
 #define MEM_STORE(addr, typ, data)                                                \
-    sprintf(funcbuf, "    *(%s *)TO_HOST(%s) = (%s)" #data ";\n", (typ), (addr), (typ)); \
+    sprintf(funcbuf, "    *(guest_%s *)TO_HOST(%s) = (%s)" #data ";\n", (typ), (addr), (typ)); \
     s = str_append(s, funcbuf);                                                   \
 
-static str_t func_empty(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_empty(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     return s;
 }
 
@@ -114,31 +130,31 @@ static str_t func_empty(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);  \
     return s;                                                  \
 
-static str_t func_lb(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lb(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int8_t");
 }
 
-static str_t func_lh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lh(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int16_t");
 }
 
-static str_t func_lw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int32_t");
 }
 
-static str_t func_ld(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_ld(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int64_t");
 }
 
-static str_t func_lbu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lbu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint8_t");
 }
 
-static str_t func_lhu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lhu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint16_t");
 }
 
-static str_t func_lwu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lwu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint32_t");
 }
 
@@ -151,61 +167,61 @@ static str_t func_lwu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1); \
     return s;                                                 \
 
-static str_t func_addi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_addi(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm)));
 }
 
-static str_t func_slli(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_slli(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 << %d", insn->imm & 0x3f)));
 }
 
-static str_t func_slti(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_slti(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)rs1 < (int64_t)%ldLL ? 1 : 0", (i64)insn->imm)));
 }
 
-static str_t func_sltiu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sltiu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 < %luULL ? 1 : 0", (i64)insn->imm)))
 }
 
-static str_t func_xori(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_xori(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 ^ %ldLL", (i64)insn->imm)));
 }
 
-static str_t func_srli(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_srli(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 >> %d", insn->imm & 0x3f)));
 }
 
-static str_t func_srai(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_srai(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)rs1 >> %d", insn->imm & 0x3f)));
 }
 
-static str_t func_ori(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_ori(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 | %luULL", (i64)insn->imm)));
 }
 
-static str_t func_andi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_andi(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "rs1 & %luULL", (i64)insn->imm)));
 }
 
-static str_t func_addiw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_addiw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(rs1 + (int64_t)%ldLL)", (i64)insn->imm)));
 }
 
-static str_t func_slliw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_slliw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)(rs1 << %d)", insn->imm & 0x1f)));
 }
 
-static str_t func_srliw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_srliw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)(int32_t)((uint32_t)rs1 >> %d)", insn->imm & 0x1f)));
 }
 
-static str_t func_sraiw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sraiw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((sprintf(funcbuf2, "(int64_t)((int32_t)rs1 >> %d)", insn->imm & 0x1f)));
 }
 
 #undef FUNC
 
-static str_t func_auipc(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_auipc(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     u64 val = pc + (i64)insn->imm;
     REG_SET_VAL(insn->rd, val);
 
@@ -221,19 +237,19 @@ static str_t func_auipc(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, -1); \
     return s;                                                  \
 
-static str_t func_sb(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sb(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint8_t");
 }
 
-static str_t func_sh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sh(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint16_t");
 }
 
-static str_t func_sw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint32_t");
 }
 
-static str_t func_sd(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sd(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t");
 }
 
@@ -246,91 +262,103 @@ static str_t func_sd(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u6
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
     return s;                                                            \
 
-static str_t func_add(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_add(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 + rs2");
 }
 
-static str_t func_sll(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sll(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 << (rs2 & 0x3f)");
 }
 
-static str_t func_slt(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_mulh(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("(uint64_t)(((__int128)(int64_t)rs1 * (__int128)(int64_t)rs2) >> 64)");
+}
+
+static str_t func_mulhsu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("(uint64_t)(((__int128)(int64_t)rs1 * (__int128)rs2) >> 64)");
+}
+
+static str_t func_mulhu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("(uint64_t)(((unsigned __int128)rs1 * rs2) >> 64)");
+}
+
+static str_t func_slt(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("((int64_t)rs1 < (int64_t)rs2) ? 1 : 0");
 }
 
-static str_t func_sltu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sltu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
    FUNC("((uint64_t)rs1 < (uint64_t)rs2) ? 1 : 0");
 }
 
-static str_t func_xor(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_xor(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 ^ rs2");
 }
 
-static str_t func_srl(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_srl(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 >> (rs2 & 0x3f)");
 }
 
-static str_t func_or(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_or(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 | rs2");
 }
 
-static str_t func_and(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_and(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 & rs2");
 }
 
-static str_t func_mul(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_mul(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 * rs2");
 }
 
-static str_t func_sub(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sub(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC(("rs1 - rs2"));
 }
 
-static str_t func_sra(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sra(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC(("(int64_t)rs1 >> (rs2 & 0x3f)"));
 }
 
-static str_t func_remu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_remu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(rs2 == 0 ? rs1 : rs1 % rs2)");
 }
 
-static str_t func_addw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_addw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)(rs1 + rs2)");
 }
 
-static str_t func_sllw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sllw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)(rs1 << (rs2 & 0x1f))");
 }
 
-static str_t func_srlw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_srlw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)((uint32_t)rs1 >> (rs2 & 0x1f))");
 }
 
-static str_t func_mulw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_mulw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)(rs1 * rs2)");
 }
 
-static str_t func_divw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_divw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(rs2 == 0 ? UINT64_MAX : (int32_t)((int64_t)(int32_t)rs1 / (int64_t)(int32_t)rs2))");
 }
 
-static str_t func_divuw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_divuw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(rs2 == 0 ? UINT64_MAX : (int32_t)((uint32_t)rs1 / (uint32_t)rs2))");
 }
 
-static str_t func_remw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_remw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(rs2 == 0 ? (int64_t)(int32_t)rs1 : (int64_t)(int32_t)((int64_t)(int32_t)rs1 % (int64_t)(int32_t)rs2))");
 }
 
-static str_t func_remuw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_remuw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(rs2 == 0 ? (int64_t)(int32_t)(uint32_t)rs1 : (int64_t)(int32_t)((uint32_t)rs1 % (uint32_t)rs2))");
 }
 
-static str_t func_subw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_subw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)(rs1 - rs2)");
 }
 
-static str_t func_sraw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_sraw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("(int64_t)(int32_t)((int32_t)rs1 >> (rs2 & 0x1f))");
 }
 
@@ -344,7 +372,7 @@ static str_t func_sraw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
     return s;                                                            \
 
-static str_t func_div(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_div(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((s = str_append(s,
         "    uint64_t rd = 0;                                   \n"
         "    if (rs2 == 0) {                                    \n"
@@ -356,7 +384,7 @@ static str_t func_div(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
         "    }                                                  \n")));
 }
 
-static str_t func_divu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_divu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((s = str_append(s,
         "    uint64_t rd = 0;    \n"
         "    if (rs2 == 0) {     \n"
@@ -366,7 +394,7 @@ static str_t func_divu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
         "    }                   \n")));
 }
 
-static str_t func_rem(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_rem(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC((s = str_append(s,
         "    uint64_t rd = 0;                                   \n"
         "    if (rs2 == 0) {                                    \n"
@@ -380,53 +408,66 @@ static str_t func_rem(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
 
 #undef FUNC
 
-static str_t func_lui(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_lui(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     tracer_add_gp_reg_usage(tracer, insn->rd, -1);
     REG_SET_VAL(insn->rd, (i64)insn->imm);
     return s;
 }
 
+/// @brief 追加跳转的 if：一边是冷的时候条件加上 __builtin_expect，编译器把冷的一边放到热代码之外
+static str_t branch_if(str_t s, const char *cond, u64 taken, u64 next) {
+    bool cold_taken = ir_cold(taken), cold_next = ir_cold(next);
+    s = str_append(s, "    if (");
+    if (cold_taken == cold_next) {
+        s = str_append(s, cond);
+    } else {
+        s = str_append(s, "__builtin_expect(");
+        s = str_append(s, cond);
+        s = str_append(s, cold_next ? ", 1)" : ", 0)");
+    }
+    return str_append(s, ") {\n");
+}
+
 #define FUNC(typ, op)                                                  \
     REG_GET(insn->rs1, rs1);                                           \
     REG_GET(insn->rs2, rs2);                                           \
     u64 target_addr = pc + (i64)insn->imm;                             \
-    sprintf(funcbuf, "    if ((%s)rs1 %s (%s)rs2) {\n", typ, op, typ); \
-    s = str_append(s, funcbuf);                                        \
-    sprintf(funcbuf, "        goto insn_%lx;\n", target_addr);         \
+    sprintf(funcbuf2, "(%s)rs1 %s (%s)rs2", typ, op, typ);             \
+    s = branch_if(s, funcbuf2, target_addr, pc + insn->len);           \
+    sprintf(funcbuf, "        %s;\n", goto_stmt(target_addr));         \
     s = str_append(s, funcbuf);                                        \
     s = str_append(s, "    }\n");                                      \
-    stack_push(stack, target_addr);                                    \
     tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rs2, -1);         \
     return s;                                                          \
 
-static str_t func_beq(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_beq(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t", "==");
 }
 
-static str_t func_bne(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_bne(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t", "!=");
 }
 
-static str_t func_blt(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_blt(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int64_t", "<");
 }
 
-static str_t func_bge(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_bge(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("int64_t", ">=");
 }
 
-static str_t func_bltu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_bltu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t", "<");
 }
 
-static str_t func_bgeu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_bgeu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t", ">=");
 }
 
 #undef FUNC
 
-static str_t func_jalr(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    u64 return_addr = pc + (insn->rvc ? 2 : 4);
+static str_t func_jalr(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    u64 return_addr = pc + insn->len;
     REG_GET(insn->rs1, rs1);
     REG_SET_VAL(insn->rd, return_addr);
 
@@ -440,70 +481,101 @@ static str_t func_jalr(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     return s;
 }
 
-static str_t func_jal(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    u64 return_addr = pc + (insn->rvc ? 2 : 4);
+static str_t func_jal(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    u64 return_addr = pc + insn->len;
     u64 target_addr = pc + (i64)insn->imm;
 
     REG_SET_VAL(insn->rd, return_addr);
-    sprintf(funcbuf, "    goto insn_%lx;\n", target_addr);
+    sprintf(funcbuf, "    %s;\n", goto_stmt(target_addr));
     s = str_append(s, funcbuf);
-    stack_push(stack, target_addr);
     s = str_append(s, "}\n");
 
     tracer_add_gp_reg_usage(tracer, insn->rd, -1);
     return s;
 }
 
-static str_t func_ecall(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    s = str_append(s, "    state->exit_reason = ecall;\n");
-    sprintf(funcbuf, "    state->reenter_pc = %luULL;\n", pc + 4);
-    s = str_append(s, funcbuf);
-    s = str_append(s, "    goto end;\n");
-    s = str_append(s, "}\n");
+static str_t func_zext(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    REG_GET(insn->rs1, rs1);
+    sprintf(funcbuf2, "(rs1 << %d) >> %d", insn->imm & 0x3f, insn->imm & 0x3f);
+    REG_SET_EXPR(insn->rd, funcbuf2);
+    tracer_add_gp_reg_usage(tracer, insn->rs1, insn->rd, -1);
     return s;
 }
 
-#define FUNC()                                         \
-    switch (insn->csr) {                               \
-    case fflags:                                       \
-    case frm:                                          \
-    case fcsr:                                         \
-        break;                                         \
-    default: fatal("unsupported csr");                 \
-    }                                                  \
-    if (insn->rd) {                                    \
-        sprintf(funcbuf, "    x%d = 0;\n", insn->rd);  \
-        tracer_add_gp_reg_usage(tracer, insn->rd, -1); \
-        s = str_append(s, funcbuf);                    \
-    }                                                  \
-    return s;                                          \
-
-static str_t func_csrrw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_ld_pc(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    sprintf(funcbuf2, "%luULL", pc + (i64)insn->imm);
+    MEM_LOAD(funcbuf2, "int64_t", rd);
+    REG_SET_EXPR(insn->rd, "rd");
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+    return s;
 }
 
-static str_t func_csrrs(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+#define SYS_clock_gettime 113
+#define SYS_gettimeofday  169
+#define SYS_getpid        172
+
+/// @brief 不需要写回状态、可以直接调用主机函数的系统调用（主机 libc 内部走 vDSO）
+///        TEMU_STATS 时 getpid 走 state->syscall，才能计数
+static bool ecall_has_fast_path(i64 n) {
+    return n == SYS_clock_gettime || n == SYS_gettimeofday || (n == SYS_getpid && !TEMU_STATS);
+}
+
+static str_t ecall_append_fast_path(str_t s, i64 n, u64 pc) {
+    switch (n) {
+    case SYS_clock_gettime:
+        s = str_append(s, "        x10 = (int64_t)state->clock_gettime((int)x10, (void *)TO_HOST(x11));\n");
+        break;
+    case SYS_gettimeofday:
+        s = str_append(s, "        x10 = (int64_t)state->gettimeofday((void *)TO_HOST(x10),\n"
+                          "                                          x11 ? (void *)TO_HOST(x11) : (void *)0);\n");
+        break;
+    case SYS_getpid:
+        // 不支持 fork：pid 在翻译时就确定
+        sprintf(funcbuf, "        x10 = %dLL;\n", getpid());
+        s = str_append(s, funcbuf);
+        break;
+    default:
+        unreachable();
+    }
+    sprintf(funcbuf, "        %s;\n", goto_stmt(pc + 4));
+    return str_append(s, funcbuf);
 }
 
-static str_t func_csrrc(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
-}
+/**
+ * 系统调用不跳出代码块：只把参数寄存器 a0-a7 写回 state，
+ * 直接调用 state->syscall，返回值写入 a0 后继续执行下一条指令。
+ * 退出类系统调用之后往往不是指令，IR 已经把它变成跳出代码块
+ */
+static str_t func_ecall(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    bool known = tracer->a7_pc == pc;
+    // 预测的编号在运行时还要检查：其他路径跳到这里时 a7 可能不同
+    if (known && ecall_has_fast_path(tracer->a7_val)) {
+        sprintf(funcbuf, "    if (x%d == %ldLL) {\n", a7, tracer->a7_val);
+        s = str_append(s, funcbuf);
+        s = ecall_append_fast_path(s, tracer->a7_val, pc);
+        s = str_append(s, "    }\n");
+    }
 
-static str_t func_csrrwi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
-}
+    for (int reg = a0; reg <= a7; reg++) {
+        sprintf(funcbuf, "    state->gp_regs[%d] = x%d;\n", reg, reg);
+        s = str_append(s, funcbuf);
+        tracer_add_gp_reg_usage(tracer, reg, -1);
+    }
+    sprintf(funcbuf, "    x%d = state->syscall((void *)state);\n", a0);
+    s = str_append(s, funcbuf);
 
-static str_t func_csrrsi(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+    sprintf(funcbuf, "    %s;\n", goto_stmt(pc + 4));
+    s = str_append(s, funcbuf);
+    s = str_append(s, "}\n");
+    return s;
 }
 
-static str_t func_csrrci(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+/// csr 指令在 ir_build 中已经换成跳出到解释器
+static str_t func_csr(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    fatal("codegen: csr instructions run in the interpreter");
+    return s;
 }
 
-#undef FUNC
-
 #define FUNC(typ, expr)                                        \
     REG_GET(insn->rs1, rs1);                                   \
     sprintf(funcbuf2, "rs1 + (int64_t)%ldLL", (i64)insn->imm); \
@@ -513,11 +585,11 @@ static str_t func_csrrci(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack
     tracer_add_fp_reg_usage(tracer, insn->rd, -1);             \
     return s;                                                  \
 
-static str_t func_flw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_flw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint32_t", "rd | ((uint64_t)-1 << 32)");
 }
 
-static str_t func_fld(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fld(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t", "rd");
 }
 
@@ -532,11 +604,11 @@ static str_t func_fld(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
     tracer_add_fp_reg_usage(tracer, insn->rs2, -1);            \
     return s;                                                  \
 
-static str_t func_fsw(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fsw(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint32_t");
 }
 
-static str_t func_fsd(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fsd(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("uint64_t");
 }
 
@@ -550,20 +622,20 @@ static str_t func_fsd(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rs3, insn->rd, -1); \
     return s;                                                                       \
 
-static str_t func_fmadd_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("rs1 * rs2 + rs3");
+static str_t func_fmadd_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fmaf(rs1, rs2, rs3)");
 }
 
-static str_t func_fmsub_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("rs1 * rs2 - rs3");
+static str_t func_fmsub_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fmaf(rs1, rs2, -rs3)");
 }
 
-static str_t func_fnmsub_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("-(rs1 * rs2) + rs3");
+static str_t func_fnmsub_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fmaf(-rs1, rs2, rs3)");
 }
 
-static str_t func_fnmadd_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("-(rs1 * rs2) - rs3");
+static str_t func_fnmadd_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fmaf(-rs1, rs2, -rs3)");
 }
 
 #undef FUNC
@@ -576,20 +648,20 @@ static str_t func_fnmadd_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rs3, insn->rd, -1);  \
     return s;                                                                        \
 
-static str_t func_fmadd_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("rs1 * rs2 + rs3");
+static str_t func_fmadd_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fma(rs1, rs2, rs3)");
 }
 
-static str_t func_fmsub_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("rs1 * rs2 - rs3");
+static str_t func_fmsub_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fma(rs1, rs2, -rs3)");
 }
 
-static str_t func_fnmsub_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("-(rs1 * rs2) + rs3");
+static str_t func_fnmsub_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fma(-rs1, rs2, rs3)");
 }
 
-static str_t func_fnmadd_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC("-(rs1 * rs2) - rs3");
+static str_t func_fnmadd_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("__builtin_fma(-rs1, rs2, -rs3)");
 }
 
 #undef FUNC
@@ -601,33 +673,33 @@ static str_t func_fnmadd_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
     return s;                                                            \
 
-static str_t func_fadd_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fadd_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 + rs2");
 }
 
-static str_t func_fsub_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fsub_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 - rs2");
 }
 
-static str_t func_fmul_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmul_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 * rs2");
 }
 
-static str_t func_fdiv_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fdiv_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 / rs2");
 }
 
-static str_t func_fmin_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmin_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 < rs2 ? rs1 : rs2");
 }
 
-static str_t func_fmax_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmax_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 > rs2 ? rs1 : rs2");
 }
 
 #undef FUNC
 
-static str_t func_fcvt_s_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_s_w(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(float)(int32_t)rs1", f);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -635,7 +707,7 @@ static str_t func_fcvt_s_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     return s;
 }
 
-static str_t func_fcvt_s_wu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_s_wu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(float)(uint32_t)rs1", f);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -643,7 +715,7 @@ static str_t func_fcvt_s_wu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *st
     return s;
 }
 
-static str_t func_fcvt_d_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_d_w(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(double)(int32_t)rs1", d);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -651,7 +723,7 @@ static str_t func_fcvt_d_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     return s;
 }
 
-static str_t func_fcvt_d_wu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_d_wu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(double)(uint32_t)rs1", d);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -659,7 +731,7 @@ static str_t func_fcvt_d_wu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *st
     return s;
 }
 
-static str_t func_fmv_x_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmv_x_w(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FREG_GET(insn->rs1, rs1, uint32_t, w);
     REG_SET_EXPR(insn->rd, "(int64_t)(int32_t)rs1");
     tracer_add_gp_reg_usage(tracer, insn->rd, -1);
@@ -667,7 +739,7 @@ static str_t func_fmv_x_w(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stac
     return s;
 }
 
-static str_t func_fmv_w_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmv_w_x(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(uint32_t)rs1", w);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -675,7 +747,7 @@ static str_t func_fmv_w_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stac
     return s;
 }
 
-static str_t func_fmv_x_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmv_x_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FREG_GET(insn->rs1, rs1, uint64_t, v);
     REG_SET_EXPR(insn->rd, "rs1");
     tracer_add_gp_reg_usage(tracer, insn->rd, -1);
@@ -684,7 +756,7 @@ static str_t func_fmv_x_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stac
 }
 
 
-static str_t func_fmv_d_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmv_d_x(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "rs1", v);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -700,15 +772,15 @@ static str_t func_fmv_d_x(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stac
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, -1); \
     return s;                                                  \
 
-static str_t func_feq_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_feq_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 == rs2");
 }
 
-static str_t func_flt_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_flt_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 < rs2");
 }
 
-static str_t func_fle_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fle_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 <= rs2");
 }
 
@@ -722,21 +794,21 @@ static str_t func_fle_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack,
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, -1); \
     return s;                                                  \
 
-static str_t func_feq_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_feq_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 == rs2");
 }
 
-static str_t func_flt_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_flt_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 < rs2");
 }
 
-static str_t func_fle_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fle_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 <= rs2");
 }
 
 #undef FUNC
 
-static str_t func_fcvt_s_l(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_s_l(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(float)(int64_t)rs1", f);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -744,7 +816,7 @@ static str_t func_fcvt_s_l(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     return s;
 }
 
-static str_t func_fcvt_s_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_s_lu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(float)(uint64_t)rs1", f);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -759,47 +831,47 @@ static str_t func_fcvt_s_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *st
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1); \
     return s;                                                            \
 
-static str_t func_fadd_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fadd_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 + rs2");
 }
 
-static str_t func_fsub_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fsub_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 - rs2");
 }
 
-static str_t func_fmul_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmul_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 * rs2");
 }
 
-static str_t func_fdiv_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fdiv_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 / rs2");
 }
 
-static str_t func_fmin_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmin_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 < rs2 ? rs1 : rs2");
 }
 
-static str_t func_fmax_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fmax_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FUNC("rs1 > rs2 ? rs1 : rs2");
 }
 
 #undef FUNC
 
-static str_t func_fcvt_s_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_s_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FREG_GET(insn->rs1, rs1, double, d);
     FREG_SET_EXPR(insn->rd, "(float)rs1", f);
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
     return s;
 }
 
-static str_t func_fcvt_d_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_d_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     FREG_GET(insn->rs1, rs1, float, f);
     FREG_SET_EXPR(insn->rd, "(double)rs1", d);
     tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
     return s;
 }
 
-static str_t func_fcvt_d_l(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_d_l(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(double)(int64_t)rs1", d);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -807,7 +879,7 @@ static str_t func_fcvt_d_l(str_t s, insn_t *insn, tracer_t *tracer, stack_t *sta
     return s;
 }
 
-static str_t func_fcvt_d_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
+static str_t func_fcvt_d_lu(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
     REG_GET(insn->rs1, rs1);
     FREG_SET_EXPR(insn->rd, "(double)(uint64_t)rs1", d);
     tracer_add_gp_reg_usage(tracer, insn->rs1, -1);
@@ -815,102 +887,114 @@ static str_t func_fcvt_d_lu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *st
     return s;
 }
 
-#define FUNC() \
-    s = str_append(s, "    state->exit_reason = interp;\n");   \
-    sprintf(funcbuf, "    state->reenter_pc = %luULL;\n", pc); \
-    s = str_append(s, funcbuf);                                \
-    s = str_append(s, "    goto end;\n");                      \
-    s = str_append(s, "}\n");                                  \
-    insn->cont = true;                                         \
-    return s;                                                  \
-
-static str_t func_mulh(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsqrt_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FREG_GET(insn->rs1, rs1, float, f);
+    FREG_SET_EXPR(insn->rd, "__builtin_sqrtf(rs1)", f);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
 }
 
-static str_t func_mulhsu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsqrt_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FREG_GET(insn->rs1, rs1, double, d);
+    FREG_SET_EXPR(insn->rd, "__builtin_sqrt(rs1)", d);
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rd, -1);
+    return s;
 }
 
-static str_t func_mulhu(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
-}
+/// 与解释器相同：按主机当前的舍入方式，不看指令中的 rm
+#define FUNC(typ, field, expr)                                 \
+    FREG_GET(insn->rs1, rs1, typ, field);                      \
+    REG_SET_EXPR(insn->rd, expr);                              \
+    tracer_add_gp_reg_usage(tracer, insn->rd, -1);             \
+    tracer_add_fp_reg_usage(tracer, insn->rs1, -1);            \
+    return s;                                                  \
 
-static str_t func_fsqrt_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_w_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(float, f, "(int64_t)(int32_t)__builtin_llrintf(rs1)");
 }
 
-static str_t func_fcvt_w_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_wu_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(float, f, "(int64_t)(int32_t)(uint32_t)__builtin_llrintf(rs1)");
 }
 
-static str_t func_fcvt_wu_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_l_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(float, f, "(int64_t)__builtin_llrintf(rs1)");
 }
 
-static str_t func_fcvt_w_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_lu_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(float, f, "(uint64_t)__builtin_llrintf(rs1)");
 }
 
-static str_t func_fcvt_wu_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_w_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(double, d, "(int64_t)(int32_t)__builtin_llrint(rs1)");
 }
 
-static str_t func_fclass_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_wu_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(double, d, "(int64_t)(int32_t)(uint32_t)__builtin_llrint(rs1)");
 }
 
-static str_t func_fclass_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_l_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(double, d, "(int64_t)__builtin_llrint(rs1)");
 }
 
-static str_t func_fcvt_l_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fcvt_lu_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(double, d, "(uint64_t)__builtin_llrint(rs1)");
 }
 
-static str_t func_fcvt_lu_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fclass_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(uint32_t, w, "fclass_s(rs1)");
 }
 
-static str_t func_fcvt_l_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fclass_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC(uint64_t, v, "fclass_d(rs1)");
 }
 
-static str_t func_fcvt_lu_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
-}
+#undef FUNC
 
-static str_t func_fsgnj_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
-}
+/// 单精度的结果在高 32 位补 1
+#define FUNC(sign)                                                                                         \
+    FREG_GET(insn->rs1, rs1, uint32_t, w);                                                                 \
+    FREG_GET(insn->rs2, rs2, uint32_t, w);                                                                 \
+    FREG_SET_EXPR(insn->rd, "(rs1 & 0x7fffffffU) | ((" sign ") & 0x80000000U) | ((uint64_t)-1 << 32)", v); \
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1);                                   \
+    return s;                                                                                              \
 
-static str_t func_fsgnjn_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsgnj_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("rs2");
 }
 
-static str_t func_fsgnjx_s(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsgnjn_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("~rs2");
 }
 
-static str_t func_fsgnj_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsgnjx_s(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("rs1 ^ rs2");
 }
 
-static str_t func_fsgnjn_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+#undef FUNC
+
+#define FUNC(sign)                                                                     \
+    FREG_GET(insn->rs1, rs1, uint64_t, v);                                             \
+    FREG_GET(insn->rs2, rs2, uint64_t, v);                                             \
+    FREG_SET_EXPR(insn->rd, "(rs1 & ~(1ULL << 63)) | ((" sign ") & (1ULL << 63))", v); \
+    tracer_add_fp_reg_usage(tracer, insn->rs1, insn->rs2, insn->rd, -1);               \
+    return s;                                                                          \
+
+static str_t func_fsgnj_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("rs2");
 }
 
-static str_t func_fsgnjx_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsgnjn_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("~rs2");
 }
 
-static str_t func_fsqrt_d(str_t s, insn_t *insn, tracer_t *tracer, stack_t *stack, u64 pc) {
-    FUNC();
+static str_t func_fsgnjx_d(str_t s, insn_t *insn, tracer_t *tracer, u64 pc) {
+    FUNC("rs1 ^ rs2");
 }
 
 #undef FUNC
 
-typedef str_t (func_t)(str_t, insn_t *, tracer_t *, stack_t *, u64);
+typedef str_t (func_t)(str_t, insn_t *, tracer_t *, u64);
 
 static func_t *funcs[] = {
     func_lb,
@@ -977,13 +1061,15 @@ static func_t *funcs[] = {
     func_bgeu,
     func_jalr,
     func_jal,
+    func_zext,
+    func_ld_pc,
     func_ecall,
-    func_csrrw,
-    func_csrrs,
-    func_csrrc,
-    func_csrrwi,
-    func_csrrsi,
-    func_csrrci,
+    func_csr,
+    func_csr,
+    func_csr,
+    func_csr,
+    func_csr,
+    func_csr,
     func_flw,
     func_fsw,
     func_fmadd_s,
@@ -1050,13 +1136,21 @@ static func_t *funcs[] = {
 
 #define CODEGEN_PROLOGUE                                \
     "#define OFFSET 0x088800000000ULL               \n" \
-    "#define TO_HOST(addr) (addr + OFFSET)          \n" \
+    "static uint8_t *const guest = (void *)OFFSET;  \n" \
+    "#define TO_HOST(addr) (guest + (addr))         \n" \
+    "#define GUEST_TYPE(typ) typedef typ          \\\n" \
+    "    __attribute__((may_alias, aligned(1)))   \\\n" \
+    "    guest_##typ;                               \n" \
+    "GUEST_TYPE(int8_t)  GUEST_TYPE(uint8_t)        \n" \
+    "GUEST_TYPE(int16_t) GUEST_TYPE(uint16_t)       \n" \
+    "GUEST_TYPE(int32_t) GUEST_TYPE(uint32_t)       \n" \
+    "GUEST_TYPE(int64_t) GUEST_TYPE(uint64_t)       \n" \
     "enum exit_reason_t {                           \n" \
     "   none,                                       \n" \
     "   direct_branch,                              \n" \
     "   indirect_branch,                            \n" \
-    "   interp,                                     \n" \
     "   ecall,                                      \n" \
+    "   interp,                                     \n" \
     "};                                             \n" \
     "typedef union {                                \n" \
     "    uint64_t v;                                \n" \
@@ -1070,61 +1164,382 @@ static func_t *funcs[] = {
     "    uint64_t gp_regs[32];                      \n" \
     "    fp_reg_t fp_regs[32];                      \n" \
     "    uint64_t pc;                               \n" \
+    "    uint64_t (*syscall)(void *);               \n" \
+    "    int (*clock_gettime)(int, void *);         \n" \
+    "    int (*gettimeofday)(void *, void *);       \n" \
     "    uint32_t fcsr;                             \n" \
+    "    uint32_t mxcsr;                            \n" \
     "} state_t;                                     \n" \
-    "void start(volatile state_t *restrict state) { \n" \
+    "static inline uint64_t fclass_s(uint32_t a) {  \n" \
+    "    uint32_t e = a >> 23 & 0xff, f = a << 9;   \n" \
+    "    int s = a >> 31;                           \n" \
+    "    if (e == 0xff)                             \n" \
+    "        return !f ? (s ? 1 : 128) : f >> 31 ? 512 : 256;\n" \
+    "    if (e == 0) return !f ? (s ? 8 : 16) : (s ? 4 : 32);\n" \
+    "    return s ? 2 : 64;                         \n" \
+    "}                                              \n" \
+    "static inline uint64_t fclass_d(uint64_t a) {  \n" \
+    "    uint64_t e = a >> 52 & 0x7ff, f = a << 12; \n" \
+    "    int s = a >> 63;                           \n" \
+    "    if (e == 0x7ff)                            \n" \
+    "        return !f ? (s ? 1 : 128) : f >> 63 ? 512 : 256;\n" \
+    "    if (e == 0) return !f ? (s ? 8 : 16) : (s ? 4 : 32);\n" \
+    "    return s ? 2 : 64;                         \n" \
+    "}                                              \n" \
+
+#define CODEGEN_EPILOGUE "}\n"
+
+/// @brief 记录代码块的入口：去掉重复的 pc
+static void entries_add(entries_t *entries, u64 pc) {
+    if (entries->n == CODEGEN_MAX_ENTRIES) return;
+    for (u64 i = 0; i < entries->n; i++)
+        if (entries->pcs[i] == pc) return;
+    entries->pcs[entries->n++] = pc;
+}
+
+/// 跳出原因在生成代码中的名字
+static const char *exit_reason_names[] = {
+    [none] = "none",
+    [direct_branch] = "direct_branch",
+    [indirect_branch] = "indirect_branch",
+    [ecall] = "ecall",
+    [interp] = "interp",
+};
 
-#define CODEGEN_EPILOGUE "}"
+// ============================================================================== //
+// 栈槽：slot_<k> 保存栈槽的原始位，写栈槽时同时写内存
+// ============================================================================== //
 
-str_t machine_genblock(machine_t *m) {
-    DECLEAR_STATIC_STR(body);
+static const char *slot_types[] = { [1] = "uint8_t", [2] = "uint16_t", [4] = "uint32_t", [8] = "uint64_t" };
+
+/// @brief 从内存重新读取 mask 中的栈槽：入口处，以及其他基址写到栈槽附近之后
+static str_t genblock_reload(str_t s, ir_slot_t *slots, u64 mask) {
+    for (u64 m = mask; m; m &= m - 1) {
+        int k = __builtin_ctzll(m);
+        sprintf(funcbuf, "        slot_%d = *(guest_%s *)TO_HOST(x%d + (int64_t)%dLL);\n",
+                k, slot_types[slots[k].size], slots[k].base, slots[k].off);
+        s = str_append(s, funcbuf);
+    }
+    return s;
+}
 
-    static stack_t stack = {0};
-    stack_reset(&stack);
+/**
+ * @brief 栈槽的读写：读有效的栈槽时不访问内存，其他读写之后更新 slot_<k>
+ *     其他基址的写内存落在有效的栈槽附近时，重新读取这些栈槽
+ */
+static str_t genblock_mem(str_t s, ir_insn_t *e, insn_t *insn, ir_slot_t *slots, tracer_t *tracer) {
+    static const char *load_exts[] = {
+        [insn_lb] = "(int64_t)(int8_t)", [insn_lh] = "(int64_t)(int16_t)", [insn_lw] = "(int64_t)(int32_t)",
+        [insn_ld] = "", [insn_lbu] = "", [insn_lhu] = "", [insn_lwu] = "",
+    };
+    bool load = insn->type <= insn_lwu;
+    if (load && e->slot >= 0 && (e->avail >> e->slot & 1)) {
+        sprintf(funcbuf2, "%sslot_%d", load_exts[insn->type], e->slot);
+        REG_SET_EXPR(insn->rd, funcbuf2);
+        tracer_add_gp_reg_usage(tracer, insn->rd, -1);
+        return s;
+    }
 
-    static set_t set;
-    set_reset(&set);
+    s = funcs[insn->type](s, insn, tracer, e->pc);
+    if (e->slot >= 0) {
+        sprintf(funcbuf, "    slot_%d = (%s)%s;\n", e->slot, slot_types[slots[e->slot].size], load ? "rd" : "rs2");
+        s = str_append(s, funcbuf);
+    } else if (!load && e->avail != 0) {
+        // 写入 [addr, addr + 8) 与栈槽 [lo, hi) 相交
+        i64 lo, hi;
+        ir_slots_range(e->avail, &lo, &hi);
+        sprintf(funcbuf, "    if (rs1 + (int64_t)%dLL - (x%d + (int64_t)%ldLL) < %luULL) {\n",
+                insn->imm, slots[0].base, lo - 7, (u64)(hi - lo + 7));
+        s = str_append(s, funcbuf);
+        s = genblock_reload(s, slots, e->avail);
+        s = str_append(s, "    }\n");
+    }
+    return s;
+}
 
-    static tracer_t tracer;
-    tracer_reset(&tracer);
+/// @brief 翻译一条 IR 指令：不跳出时总是 goto 下一条指令
+static str_t genblock_insn(str_t s, ir_insn_t *e, ir_slot_t *slots, tracer_t *tracer) {
+    static insn_t insn;
+    insn = e->insn;
+    int rd = insn.rd;
+
+    switch (e->kind) {
+    case ir_exit:
+        sprintf(funcbuf, "    state->exit_reason = %s;\n", exit_reason_names[e->reason]);
+        s = str_append(s, funcbuf);
+        sprintf(funcbuf, "    state->reenter_pc = %luULL;\n", e->val);
+        s = str_append(s, funcbuf);
+        return str_append(s, "    goto end;\n}\n");
+    case ir_li:
+        sprintf(funcbuf, "    x%d = %luULL;\n", rd, e->val);
+        s = str_append(s, funcbuf);
+        tracer_add_gp_reg_usage(tracer, rd, -1);
+        break;
+    case ir_mv:
+        sprintf(funcbuf2, "x%d", insn.rs1);
+        REG_SET_EXPR(rd, funcbuf2);
+        tracer_add_gp_reg_usage(tracer, insn.rs1, rd, -1);
+        break;
+    case ir_nop:
+        break;
+    case ir_insn:
+        if (e->known) {
+            tracer->a7_pc = e->pc;
+            tracer->a7_val = e->val;
+        }
+        if (insn.type <= insn_lwu || (insn.type >= insn_sb && insn.type <= insn_sd))
+            s = genblock_mem(s, e, &insn, slots, tracer);
+        else
+            s = funcs[insn.type](s, &insn, tracer, e->pc);
+        if (insn.cont) return s;
+        break;
+    }
 
-    stack_push(&stack, m->state.pc);
+    sprintf(funcbuf, "    %s;\n}\n", goto_stmt(e->pc + insn.len));
+    return str_append(s, funcbuf);
+}
+
+// ============================================================================== //
+// 循环：把自然循环还原成 for (;;)，循环只能从循环头进入，clang 才会做 LICM 与向量化
+// ============================================================================== //
+
+static i32 loop_head[IR_MAX_INSNS];     // 所在最内层循环的循环头：-1 表示不在循环中
+static i32 loop_outer[IR_MAX_INSNS];    // 循环头：外层循环的循环头，-1 表示没有
+static bool loop_done[IR_MAX_INSNS];    // 循环头：循环已经生成
+static u16 loop_latches[IR_MAX_INSNS];  // 循环头：回边数
+static bool loop_inner[IR_MAX_INSNS];   // 回边起点：回边属于最内层循环，写成 continue
+static bool loop_nested[IR_MAX_INSNS];  // 循环头：还有外层循环共用这个循环头
+static i32 pred_start[IR_MAX_INSNS + 1];
+static i32 preds[IR_MAX_INSNS * 2];     // 前驱：pred_start[i] 开始
+static i32 latches[IR_MAX_INSNS * 2];   // 回边的起点，与 heads 一一对应
+static i32 heads[IR_MAX_INSNS * 2];
+static i32 order[IR_MAX_INSNS];         // DFS 先序
+static i32 work[IR_MAX_INSNS];
+static u32 mark[IR_MAX_INSNS];
+static u32 mark_gen;
+
+/// @brief 代码块内的后继：顺序执行与直接跳转
+static int ir_succs(ir_insn_t *ir, i32 i, i32 out[2]) {
+    ir_insn_t *e = &ir[i];
+    int n = 0;
+    if (e->next >= 0) out[n++] = e->next;
+    enum insn_type_t type = e->insn.type;
+    if (e->kind == ir_insn && ((type >= insn_beq && type <= insn_bgeu) || type == insn_jal)) {
+        i32 t = ir_find(e->pc + (i64)e->insn.imm);
+        if (t >= 0) out[n++] = t;
+    }
+    return n;
+}
+
+/// @brief 从 roots 沿前驱回溯到循环头 h，经过的指令 mark 为 mark_gen
+/// @return 是否回溯到了第一条指令
+static bool loops_walk(i32 h, i32 *roots, u64 nroots) {
+    mark[h] = ++mark_gen;
+    u64 nwork = 0;
+    for (u64 r = 0; r < nroots; r++) {
+        if (mark[roots[r]] == mark_gen) continue;
+        mark[roots[r]] = mark_gen;
+        work[nwork++] = roots[r];
+    }
+    while (nwork > 0) {
+        i32 x = work[--nwork];
+        if (x == 0) return true;
+        for (i32 p = pred_start[x]; p < pred_start[x + 1]; p++) {
+            if (mark[preds[p]] == mark_gen) continue;
+            mark[preds[p]] = mark_gen;
+            work[nwork++] = preds[p];
+        }
+    }
+    return false;
+}
 
-    u64 pc = -1;
+/**
+ * @brief 从第一条指令 DFS 找回边，沿前驱回溯出循环体；外层循环头的先序更小，先处理
+ * @return 控制流是否可归约：否则不还原循环
+ */
+static bool loops_find(ir_insn_t *ir, u64 n) {
+    i32 succ[2];
+    // 先数出前驱个数求前缀和，再倒着填入：填完后 pred_start[i] 正好是开始位置
+    memset(pred_start, 0, (n + 1) * sizeof(i32));
+    for (u64 i = 0; i < n; i++)
+        for (int k = ir_succs(ir, i, succ) - 1; k >= 0; k--) pred_start[succ[k]]++;
+    for (u64 i = 1; i <= n; i++) pred_start[i] += pred_start[i - 1];
+    for (u64 i = 0; i < n; i++)
+        for (int k = ir_succs(ir, i, succ) - 1; k >= 0; k--) preds[--pred_start[succ[k]]] = i;
+    for (u64 i = 0; i < n; i++) {
+        loop_head[i] = -1;
+        loop_outer[i] = -1;
+        loop_done[i] = false;
+        loop_latches[i] = 0;
+        loop_inner[i] = false;
+        loop_nested[i] = false;
+    }
 
-    while (stack_pop(&stack, &pc)) {
-        if (!set_add(&set, pc)) {
+    // 迭代 DFS：stack 保存指令与下一个要看的后继，mark 1 在栈上，2 已完成
+    static struct { i32 i; int k; } stack[IR_MAX_INSNS];
+    u64 nstack = 0, norder = 0, nback = 0;
+    memset(mark, 0, n * sizeof(u32));
+    mark_gen = 2;
+    stack[nstack].i = 0;
+    stack[nstack++].k = 0;
+    mark[0] = 1;
+    order[norder++] = 0;
+    while (nstack > 0) {
+        i32 i = stack[nstack - 1].i;
+        int k = stack[nstack - 1].k++;
+        if (k >= ir_succs(ir, i, succ)) {
+            mark[i] = 2;
+            nstack--;
             continue;
         }
+        i32 t = succ[k];
+        if (mark[t] == 1) {
+            latches[nback] = i;
+            heads[nback++] = t;
+            loop_latches[t]++;
+        } else if (mark[t] == 0) {
+            mark[t] = 1;
+            order[norder++] = t;
+            stack[nstack].i = t;
+            stack[nstack++].k = 0;
+        }
+    }
 
-        static char buf[128] = {0};
-        static insn_t insn = {0};
-
-        sprintf(buf, "insn_%lx: {\n", pc);
-        body = str_append(body, buf);
+    // 循环体：从回边起点沿前驱回溯到循环头；回溯到第一条指令说明循环头不支配回边，不可归约
+    for (u64 j = 0; j < norder; j++) {
+        i32 h = order[j];
+        if (loop_latches[h] == 0) continue;
+
+        // 共用循环头的多条回边：循环体包含其他回边的是外层循环
+        for (u64 b = 0; b < nback; b++) {
+            if (heads[b] != h) continue;
+            loop_inner[latches[b]] = true;
+            if (loop_latches[h] == 1) continue;
+            loops_walk(h, &latches[b], 1);
+            for (u64 c = 0; c < nback; c++)
+                if (heads[c] == h && c != b && mark[latches[c]] == mark_gen) loop_inner[latches[b]] = false;
+            loop_nested[h] |= !loop_inner[latches[b]];
+        }
 
-        u32 data = *(u32 *)TO_HOST(pc);
-        insn_decode(&insn, data);
-        body = funcs[insn.type](body, &insn, &tracer, &stack, pc);
+        loop_outer[h] = loop_head[h];
+        loop_head[h] = h;
+        u64 nroots = 0;
+        for (u64 b = 0; b < nback; b++)
+            if (heads[b] == h) work[nroots++] = latches[b];
+        if (loops_walk(h, work, nroots)) return false;
+        for (u64 i = 0; i < n; i++)
+            if (mark[i] == mark_gen && (i32)i != h) loop_head[i] = h;
+    }
+    return true;
+}
 
-        if (insn.cont) continue;
+/// @brief 可以作为入口的指令：不在循环中，或者是最外层循环的循环头
+static bool loops_entry(i32 i) {
+    return loop_head[i] < 0 || (loop_head[i] == i && loop_outer[i] < 0);
+}
 
-        pc += (insn.rvc ? 2 : 4);
-        sprintf(buf, "    goto insn_%lx;\n", pc);
+/**
+ * @brief 生成循环头为 h 的循环：先生成循环头，其他指令与内层循环按 IR 的顺序；h 为 -1 时生成整个代码块
+ *     共用循环头的外层回边 goto 到 for 之前的标号，编译器看到的仍是两层循环，
+ *     都写成 continue 合并成一条回边后内层循环就不能向量化了
+ */
+static str_t genblock_loop(str_t body, ir_insn_t *ir, u64 n, i32 h, ir_slot_t *slots, tracer_t *tracer) {
+    static char buf[128] = {0};
+    bool open = loop_open;
+    u64 pc = loop_pc;
+    if (h >= 0) {
+        loop_done[h] = true;
+        // 外层循环头：空的 asm 让这个基本块留下来，否则会和内层循环头合并
+        sprintf(buf, "insn_%lx: %sfor (;;) {\n{\n", ir[h].pc, loop_nested[h] ? "__asm__ volatile(\"\");\n" : "");
         body = str_append(body, buf);
-        body = str_append(body, "}\n");
-        stack_push(&stack, pc);
+        loop_open = true;
+        loop_pc = ir[h].pc;
+        loop_latch = loop_inner[h];
+        body = genblock_insn(body, &ir[h], slots, tracer);
     }
 
-    DECLEAR_STATIC_STR(source);
-    source = str_append(source, "#include <stdint.h>\n");
-    source = str_append(source, "#include <stdbool.h>\n");
-    source = str_append(source, CODEGEN_PROLOGUE);
+    for (u64 i = 0; i < n; i++) {
+        if ((i32)i == h) continue;
+        if (loop_head[i] == h) {
+            sprintf(buf, "insn_%lx: {\n", ir[i].pc);
+            body = str_append(body, buf);
+            loop_latch = loop_inner[i];
+            body = genblock_insn(body, &ir[i], slots, tracer);
+            continue;
+        }
+        // 在 h 的某个内层循环中：第一次遇到时生成整个内层循环
+        i32 c = loop_head[i];
+        while (c >= 0 && loop_outer[c] != h) c = loop_outer[c];
+        if (c >= 0 && !loop_done[c]) body = genblock_loop(body, ir, n, c, slots, tracer);
+    }
+
+    if (h >= 0) body = str_append(body, "}\n");
+    loop_open = open;
+    loop_pc = pc;
+    return body;
+}
+
+/// @brief 生成一个代码块函数 block_<pc>：入口由 state->reenter_pc 选择
+/// @param source 源代码
+/// @param start 代码块起点 pc
+/// @param cache 高速缓存对象：解释执行的次数用于标记冷的代码
+/// @param entries 接收代码块的入口：第一个是 start
+/// @return 追加后的源代码
+static str_t genblock_func(str_t source, u64 start, cache_t *cache, entries_t *entries) {
+    DECLEAR_STATIC_STR(body);
+
+    static tracer_t tracer;
+    tracer_reset(&tracer);
+
+    u64 n = 0, nslots = 0;
+    ir_insn_t *ir = ir_build(start, IR_MAX_INSNS, true, cache, &n);
+    ir_slot_t *slots = ir_slots(&nslots);
+    if (nslots > 0) tracer_add_gp_reg_usage(&tracer, slots[0].base, -1);
+
+    static char buf[128] = {0};
+
+    // 基本块的开头都可以作为入口：跳出代码块的指令、循环体中间除外
+    bool loops = CODEGEN_LOOPS && loops_find(ir, n);
+    if (!loops)
+        for (u64 i = 0; i < n; i++) loop_head[i] = -1;
+    entries->n = 0;
+    entries_add(entries, start);
+    for (u64 i = 0; i < n; i++)
+        if (ir[i].leader && ir[i].kind != ir_exit && loops_entry(i)) entries_add(entries, ir[i].pc);
+    body = genblock_loop(body, ir, n, -1, slots, &tracer);
+
+    sprintf(buf, "void block_%lx(state_t *restrict state) {\n", start);
+    source = str_append(source, buf);
     source = tracer_append_prologue(&tracer, source);
+    for (u64 k = 0; k < nslots; k++) {
+        sprintf(buf, "    uint64_t slot_%lu;\n", k);
+        source = str_append(source, buf);
+    }
+    source = str_append(source, "    switch (state->reenter_pc) {\n");
+    for (u64 i = 1; i < entries->n; i++) {
+        sprintf(buf, "    case %luULL:\n", entries->pcs[i]);
+        source = str_append(source, buf);
+        source = genblock_reload(source, slots, ir[ir_find(entries->pcs[i])].avail);
+        sprintf(buf, "        goto insn_%lx;\n", entries->pcs[i]);
+        source = str_append(source, buf);
+    }
+    source = str_append(source, "    }\n");
+    source = genblock_reload(source, slots, ir[0].avail);
     source = str_append(source, body);
     source = str_append(source, "end:;\n");
     source = tracer_append_epilogue(&tracer, source);
     source = str_append(source, CODEGEN_EPILOGUE);
 
+    return source;
+}
+
+str_t machine_genblock(machine_t *m, u64 *pcs, u64 n, entries_t *entries) {
+    DECLEAR_STATIC_STR(source);
+    source = str_append(source, "#include <stdint.h>\n");
+    source = str_append(source, "#include <stdbool.h>\n");
+    source = str_append(source, CODEGEN_PROLOGUE);
+    for (u64 i = 0; i < n; i++)
+        source = genblock_func(source, pcs[i], m->cache, &entries[i]);
+
     return source;
 }
\ No newline at end of file
@@ -5,102 +5,248 @@
 
 #include "temu.h"
 
-#define BINBUF_CAP 64 * 1024
-
-static u8 elfbuf[BINBUF_CAP] = {0};
-
-u8 *machine_compile(machine_t *m, str_t source) {
-    int saved_stdout = dup(STDOUT_FILENO);
-    int outp[2];
-
-    if (pipe(outp) != 0) fatal("cannot make a pipe");
-    dup2(outp[1], STDOUT_FILENO);
-    close(outp[1]);
-
-    FILE *f;
-    // '-c' 编译成 object 文件
-    f = popen("clang -O3 -c -xc -o /dev/stdout -", "w");
-    if (f == NULL) fatal("cannot compile program");
-    fwrite(source, 1, str_len(source), f);
-    pclose(f);
-    fflush(stdout);
-    // 存入 elfbuf
-    (void) read(outp[0], elfbuf, BINBUF_CAP);
-    dup2(saved_stdout, STDOUT_FILENO);
-
-    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elfbuf;
-
-    /**
-     * 架构相关：
-     * 对某些指令, clang 会生成 .rodata section.
-     * this means we need to write a mini-linker that puts the .rodata section into
-     * memory, takes its actual address, and uses symbols and relocations to apply
-     * it back to the corresponding location in the .text section.
-     */
-
-    i64 text_idx = 0, symtab_idx = 0, rela_idx = 0, rodata_idx = 0;
-    {
-        u64 shstr_shoff = ehdr->e_shoff + ehdr->e_shstrndx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shstr_shdr = (elf64_shdr_t *)(elfbuf + shstr_shoff);
-        assert(ehdr->e_shnum != 0);
-
-        for (i64 idx = 0; idx < ehdr->e_shnum; idx++) {
-            u64 shoff = ehdr->e_shoff + idx * sizeof(elf64_shdr_t);
-            elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-            char *str = (char *)(elfbuf + shstr_shdr->sh_offset + shdr->sh_name);
-            if (strcmp(str, ".text") == 0) text_idx = idx;
-            if (strcmp(str, ".rela.text") == 0) rela_idx = idx;
-            if (strncmp(str, ".rodata.", strlen(".rodata.")) == 0) rodata_idx = idx;
-            if (strcmp(str, ".symtab") == 0) symtab_idx = idx;
+#include <dlfcn.h>
+#include <sys/syscall.h>
+
+#ifndef RTLD_DEFAULT
+#define RTLD_DEFAULT ((void *)0)
+#endif
+
+/// 目标文件缓冲：按需增长
+static u8 *elfbuf = NULL;
+static u64 elfcap = 0;
+
+/// 每个 section 链接后的地址：0 表示不加载
+static u64 *sec_addr = NULL;
+static u64 sec_cap = 0;
+
+/// @brief 运行 clang 编译源代码：先写完源代码再读目标文件，clang 读完输入才开始输出
+/// @param source C 源代码
+/// @return 目标文件大小
+static u64 compile_run(str_t source) {
+    int in[2], out[2];
+    if (pipe(in) != 0 || pipe(out) != 0) fatal("cannot make a pipe");
+
+    pid_t pid = fork();
+    if (pid < 0) fatal("cannot compile program");
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]); close(in[1]);
+        close(out[0]); close(out[1]);
+        // '-c' 编译成 object 文件；融合乘加用主机 FMA 指令，其余浮点运算不能合并成 FMA
+        const char *fma = host_has_fma() ? "-mfma" : "-mno-fma";
+        execlp("clang", "clang", "-O3", "-fno-math-errno", "-ffp-contract=off", fma, "-c", "-xc", "-o", "/dev/stdout", "-", (char *)NULL);
+        _exit(127);
+    }
+    close(in[0]);
+    close(out[1]);
+
+    for (u64 off = 0, len = str_len(source); off < len;) {
+        ssize_t n = write(in[1], source + off, len - off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) fatal(strerror(errno));
+        off += n;
+    }
+    close(in[1]);
+
+    // 目标文件大小不定：一直读到 EOF
+    u64 size = 0;
+    while (true) {
+        if (size == elfcap) {
+            elfcap = MAX(elfcap * 2, 64 * 1024);
+            elfbuf = realloc(elfbuf, elfcap);
         }
+        ssize_t n = read(out[0], elfbuf + size, elfcap - size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) fatal(strerror(errno));
+        if (n == 0) break;
+        size += n;
     }
+    close(out[0]);
+
+    // <sys/wait.h> 与 stack_t 冲突：直接使用系统调用，status 为 0 表示正常退出且返回 0
+    int status = -1;
+    while (syscall(__NR_wait4, pid, &status, 0, NULL) < 0 && errno == EINTR) {}
+    if (status != 0 || size == 0) fatal("cannot compile program");
+    return size;
+}
+
+u8 *machine_compile(machine_t *m, str_t source, entries_t *entries, u64 n) {
+    u64 size = compile_run(source);
+    machine_link(m, elfbuf, size);
+
+    // 一次编译多个代码块：每个代码块按函数符号登记到高速缓存
+    u8 *code = NULL;
+    for (i64 i = n - 1; i >= 0; i--) {
+        static char name[32];
+        sprintf(name, "block_%lx", entries[i].pcs[0]);
+        code = machine_symbol(elfbuf, name);
+        assert(code != NULL);
+        cache_set(m->cache, entries[i].pcs[0], code);
+        // 块内入口：已经有代码的 pc 保持不变
+        for (u64 j = 1; j < entries[i].n; j++)
+            if (cache_lookup(m->cache, entries[i].pcs[j]) == NULL)
+                cache_set(m->cache, entries[i].pcs[j], code);
+    }
+    return code;
+}
+
+// ============================================================================== //
+// 链接器：把目标文件的各个 section 放进高速缓存，并处理重定位
+// ============================================================================== //
+
+static elf64_shdr_t *elf_shdr(u8 *elf, u64 idx) {
+    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elf;
+    return (elf64_shdr_t *)(elf + ehdr->e_shoff) + idx;
+}
+
+static const char *elf_shname(u8 *elf, elf64_shdr_t *shdr) {
+    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elf;
+    return (char *)(elf + elf_shdr(elf, ehdr->e_shstrndx)->sh_offset + shdr->sh_name);
+}
+
+/// @brief 符号的地址：未定义的符号在 temu 进程中查找，如 memcpy、sqrt
+static u64 link_resolve(u8 *elf, elf64_shdr_t *symtab, u64 idx) {
+    elf64_sym_t *sym = (elf64_sym_t *)(elf + symtab->sh_offset) + idx;
+    if (sym->st_shndx == SHN_ABS) return sym->st_value;
+    if (sym->st_shndx == SHN_UNDEF) {
+        const char *name = (char *)(elf + elf_shdr(elf, symtab->sh_link)->sh_offset + sym->st_name);
+        void *addr = dlsym(RTLD_DEFAULT, name);
+        if (addr == NULL) fatalf("jit: undefined symbol %s", name);
+        return (u64)addr;
+    }
+    if (sym->st_shndx >= SHN_LORESERVE || sec_addr[sym->st_shndx] == 0)
+        fatalf("jit: symbol in unsupported section %d", sym->st_shndx);
+    return sec_addr[sym->st_shndx] + sym->st_value;
+}
+
+static bool fits_i32(i64 val) {
+    return val == (i32)val;
+}
+
+/// @brief 跳板：目标超出 ±2GB 时 call/jmp 先跳到这里，jmp *0(%rip) 后跟 8 字节地址
+static u64 link_stub(machine_t *m, u64 target) {
+    u8 stub[14] = { 0xff, 0x25, 0, 0, 0, 0 };
+    memcpy(stub + 6, &target, 8);
+    return (u64)cache_alloc(m->cache, stub, sizeof(stub), 16);
+}
+
+/// @brief GOT 表项：存放符号地址的 8 字节，与其他数据一起放在冷区
+static u64 link_got(machine_t *m, u64 target) {
+    return (u64)cache_alloc_cold(m->cache, (u8 *)&target, 8, 8);
+}
+
+/// @brief section 是否放进冷区：数据，以及编译器分出来的冷代码 .text.unlikely、.text.cold
+static bool link_cold(u8 *elf, elf64_shdr_t *shdr) {
+    if (!(shdr->sh_flags & SHF_EXECINSTR)) return true;
+    const char *name = elf_shname(elf, shdr);
+    return strncmp(name, ".text.unlikely", 14) == 0 || strncmp(name, ".text.cold", 10) == 0;
+}
+
+static void link_rela(machine_t *m, u8 *elf, elf64_shdr_t *rela) {
+    elf64_shdr_t *symtab = elf_shdr(elf, rela->sh_link);
+    u64 base = sec_addr[rela->sh_info];
+    i64 nrels = rela->sh_size / sizeof(elf64_rela_t);
+
+    for (i64 i = 0; i < nrels; i++) {
+        elf64_rela_t *rel = (elf64_rela_t *)(elf + rela->sh_offset) + i;
+        u64 S = link_resolve(elf, symtab, rel->r_sym);     // 符号地址
+        u64 P = base + rel->r_offset;                      // 重定位位置
+        i64 A = rel->r_addend;
+        u8 *W = cache_rw(m->cache, (u8 *)P);               // P 的可写地址
+
+        switch (rel->r_type) {
+        case R_X86_64_NONE:
+            break;
+        case R_X86_64_64:
+            *(u64 *)W = S + A;
+            break;
+        case R_X86_64_PC32:
+        case R_X86_64_PLT32: {
+            i64 val = S + A - P;
+            if (!fits_i32(val) && rel->r_type == R_X86_64_PLT32) val = link_stub(m, S) + A - P;
+            if (!fits_i32(val)) fatalf("jit: relocation out of range at %lx", P);
+            *(i32 *)W = val;
+            break;
+        }
+        case R_X86_64_GOTPCREL:
+        case R_X86_64_GOTPCRELX:
+        case R_X86_64_REX_GOTPCRELX: {
+            i64 val = link_got(m, S) + A - P;
+            if (!fits_i32(val)) fatalf("jit: relocation out of range at %lx", P);
+            *(i32 *)W = val;
+            break;
+        }
+        case R_X86_64_32:
+        case R_X86_64_32S: {
+            u64 val = S + A;
+            bool ok = rel->r_type == R_X86_64_32 ? val == (u32)val : fits_i32(val);
+            if (!ok) fatalf("jit: absolute relocation out of range at %lx", P);
+            *(u32 *)W = val;
+            break;
+        }
+        default:
+            fatalf("jit: unsupported relocation type %u", rel->r_type);
+        }
+    }
+}
 
-    assert(text_idx != 0 && symtab_idx != 0);
-
-    u64 text_shoff = ehdr->e_shoff + text_idx * sizeof(elf64_shdr_t);
-    elf64_shdr_t *text_shdr = (elf64_shdr_t *)(elfbuf + text_shoff);
+void machine_link(machine_t *m, u8 *elf, u64 size) {
+#ifndef __x86_64__
+    fatal("only support x86_64 for now");
+#endif
+    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elf;
+    assert(size >= sizeof(elf64_ehdr_t) && memcmp(ehdr->e_ident, ELFMAG, 4) == 0);
+    assert(ehdr->e_shoff + ehdr->e_shnum * sizeof(elf64_shdr_t) <= size);
 
-    if (rela_idx == 0 || rodata_idx == 0) {
-        return cache_add(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
-                         text_shdr->sh_size, text_shdr->sh_addralign);
+    if (ehdr->e_shnum > sec_cap) {
+        sec_cap = ehdr->e_shnum;
+        sec_addr = realloc(sec_addr, sec_cap * sizeof(u64));
     }
-
-    u64 text_addr = 0, rodata_addr = 0;
-    {
-        u64 shoff = ehdr->e_shoff + rodata_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-        rodata_addr = (u64)cache_add(m->cache, m->state.pc, elfbuf + shdr->sh_offset,
-                  shdr->sh_size, shdr->sh_addralign);
-        text_addr = (u64)cache_add(m->cache, m->state.pc, elfbuf + text_shdr->sh_offset,
-                                   text_shdr->sh_size, text_shdr->sh_addralign);
+    memset(sec_addr, 0, ehdr->e_shnum * sizeof(u64));
+
+    // 加载所有需要分配内存的 section：.text*、.rodata*、.data*、.bss*，热代码连续放在热区
+    for (u64 idx = 1; idx < ehdr->e_shnum; idx++) {
+        elf64_shdr_t *shdr = elf_shdr(elf, idx);
+        if (!(shdr->sh_flags & SHF_ALLOC) || shdr->sh_size == 0) continue;
+        if (strcmp(elf_shname(elf, shdr), ".eh_frame") == 0) continue;    // 不需要栈回溯
+        u8 *data = shdr->sh_type == SHT_NOBITS ? NULL : elf + shdr->sh_offset;
+        u8 *(*alloc)(cache_t *, u8 *, size_t, u64) = link_cold(elf, shdr) ? cache_alloc_cold : cache_alloc;
+        u8 *addr = alloc(m->cache, data, shdr->sh_size, shdr->sh_addralign);
+        // 可写 section 由 JIT 代码经可写视图访问
+        if (shdr->sh_flags & SHF_WRITE) addr = cache_rw(m->cache, addr);
+        sec_addr[idx] = (u64)addr;
     }
 
-    // apply relocations to .text section.
-    {
-        u64 shoff = ehdr->e_shoff + rela_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *shdr = (elf64_shdr_t *)(elfbuf + shoff);
-        i64 rels = shdr->sh_size / sizeof(elf64_rela_t);
-
-        u64 symtab_shoff = ehdr->e_shoff + symtab_idx * sizeof(elf64_shdr_t);
-        elf64_shdr_t *symtab_shdr = (elf64_shdr_t *)(elfbuf + symtab_shoff);
+    // 重定位：只处理已加载的 section
+    for (u64 idx = 1; idx < ehdr->e_shnum; idx++) {
+        elf64_shdr_t *shdr = elf_shdr(elf, idx);
+        if (shdr->sh_type == SHT_RELA && shdr->sh_info < ehdr->e_shnum && sec_addr[shdr->sh_info] != 0)
+            link_rela(m, elf, shdr);
+    }
 
-        for (i64 idx = 0; idx < rels; idx++) {
-#ifndef __x86_64__
-            fatal("only support x86_64 for now");
-#endif
-            elf64_rela_t *rel = (elf64_rela_t *)(elfbuf + shdr->sh_offset + idx * sizeof(elf64_rela_t));
-            assert(rel->r_type == R_X86_64_PC32);
-
-            elf64_sym_t *sym = (elf64_sym_t *)(elfbuf + symtab_shdr->sh_offset + rel->r_sym * sizeof(elf64_sym_t));
-            u32 *loc = (u32 *)(text_addr + rel->r_offset);
-            u64 S = rodata_addr + sym->st_value; /* actual virtual address of symbol */
-            u64 P = text_addr + rel->r_offset; /* relocation address */
-            i64 A = rel->r_addend;
-            *loc = (u32)(S + A - P);
-            u64 rip_addr = P - A;
-            assert(rip_addr + *(i32 *)loc == S);
+    // 内存地址的 icache 刷新：arm, riscv
+    for (u64 idx = 1; idx < ehdr->e_shnum; idx++) {
+        elf64_shdr_t *shdr = elf_shdr(elf, idx);
+        if (sec_addr[idx] != 0 && (shdr->sh_flags & SHF_EXECINSTR))
+            __builtin___clear_cache((char *)sec_addr[idx], (char *)sec_addr[idx] + shdr->sh_size);
+    }
+}
+
+u8 *machine_symbol(u8 *elf, const char *name) {
+    elf64_ehdr_t *ehdr = (elf64_ehdr_t *)elf;
+    for (u64 idx = 0; idx < ehdr->e_shnum; idx++) {
+        elf64_shdr_t *symtab = elf_shdr(elf, idx);
+        if (symtab->sh_type != SHT_SYMTAB) continue;
+        elf64_shdr_t *strtab = elf_shdr(elf, symtab->sh_link);
+        i64 nsyms = symtab->sh_size / sizeof(elf64_sym_t);
+        for (i64 i = 0; i < nsyms; i++) {
+            elf64_sym_t *sym = (elf64_sym_t *)(elf + symtab->sh_offset) + i;
+            if (sym->st_shndx == SHN_UNDEF || sym->st_shndx >= SHN_LORESERVE) continue;
+            if (strcmp((char *)(elf + strtab->sh_offset + sym->st_name), name) == 0)
+                return (u8 *)(sec_addr[sym->st_shndx] + sym->st_value);
         }
     }
-
-    return (u8 *)text_addr;
-}
\ No newline at end of file
+    return NULL;
+}
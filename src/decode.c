@@ -371,7 +371,7 @@ static inline insn_t insn_ciwtype_read(u16 data)
     };
 }
 
-void insn_decode(insn_t *insn, u32 data)
+static void insn_decode_data(insn_t *insn, u32 data)
 {
     u32 quadrant = QUADRANT(data);
     switch (quadrant)
@@ -1522,4 +1522,59 @@ void insn_decode(insn_t *insn, u32 data)
     default:
         unreachable();
     }
-}
\ No newline at end of file
+}
+
+void insn_decode(insn_t *insn, u32 data)
+{
+    insn_decode_data(insn, data);
+    insn->len = insn->rvc ? 2 : 4;
+}
+
+bool insn_fuse(insn_t *insn, const u16 *next_data)
+{
+    enum insn_type_t type = insn->type;
+    if (type != insn_lui && type != insn_auipc && type != insn_slli) return false;
+    if (insn->rd == zero) return false;
+
+    // 确定能融合之后才读下一条指令：按半字读，压缩指令不读后一半，不越过映射的末尾
+    u32 data = next_data[0];
+    if (data == 0) return false;
+    if ((data & 0x3) == 0x3) data |= (u32)next_data[1] << 16;
+
+    // 第二条指令读写同一个寄存器：第一条的结果只给它用
+    insn_t next;
+    insn_decode(&next, data);
+    if (next.rd != insn->rd || next.rs1 != insn->rd) return false;
+
+    i64 sum = (i64)insn->imm + next.imm;
+    switch (next.type) {
+    case insn_addi:
+        if (type == insn_slli || sum != (i32)sum) return false;
+        insn->imm = sum;
+        break;
+    case insn_addiw:
+        if (type != insn_lui) return false;
+        insn->imm = (i32)((u32)insn->imm + (u32)next.imm);
+        break;
+    case insn_jalr:
+        // jalr 清掉目标地址的最低位
+        if (type != insn_auipc || sum != (i32)sum || (sum & 1)) return false;
+        insn->type = insn_jal;
+        insn->imm = sum;
+        insn->cont = true;
+        break;
+    case insn_ld:
+        if (type != insn_auipc || sum != (i32)sum) return false;
+        insn->type = insn_ld_pc;
+        insn->imm = sum;
+        break;
+    case insn_srli:
+        if (type != insn_slli || (next.imm & 0x3f) != (insn->imm & 0x3f)) return false;
+        insn->type = insn_zext;
+        break;
+    default:
+        return false;
+    }
+    insn->len += next.len;
+    return true;
+}
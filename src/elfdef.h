@@ -23,7 +23,28 @@
 #define PF_R 0x4
 
 
-#define R_X86_64_PC32 2
+#define SHT_PROGBITS 1
+#define SHT_SYMTAB   2
+#define SHT_RELA     4
+#define SHT_NOBITS   8
+
+#define SHF_WRITE     0x1
+#define SHF_ALLOC     0x2
+#define SHF_EXECINSTR 0x4
+
+#define SHN_UNDEF     0
+#define SHN_LORESERVE 0xff00
+#define SHN_ABS       0xfff1
+
+#define R_X86_64_NONE           0
+#define R_X86_64_64             1
+#define R_X86_64_PC32           2
+#define R_X86_64_PLT32          4
+#define R_X86_64_GOTPCREL       9
+#define R_X86_64_32             10
+#define R_X86_64_32S            11
+#define R_X86_64_GOTPCRELX      41
+#define R_X86_64_REX_GOTPCRELX  42
 
 
 /// @brief ELF header 结构体
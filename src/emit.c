@@ -0,0 +1,915 @@
+/**
+ * \file src/emit.c
+ * \brief 本地代码生成器：把 RV64IM 代码块直接翻译成 x86-64 机器码
+ */
+
+#include "temu.h"
+
+// ============================================================================== //
+// 代码块结构：
+//     guest 寄存器保存在 state->gp_regs，使用最多的 4 个放在被调用者保存寄存器里
+//     r15 = state，r14 = GUEST_MEMORY_OFFSET，访存使用 [r14 + base + imm]
+//     rax/rcx/rdx/rsi/rdi 为临时寄存器
+// ============================================================================== //
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+/// 缓存 guest 寄存器的主机寄存器
+static const i8 cached_regs[] = { RBX, RBP, R12, R13 };
+
+/// 一条指令最长的机器码
+#define EMIT_MAX_INSN_BYTES 96
+
+#define STATE_OFF(field) ((i32)offsetof(state_t, field))
+#define GP_OFF(reg) (STATE_OFF(gp_regs) + 8 * (reg))
+
+/// @brief x86-64 操作数：寄存器，或内存 [base + index + disp]
+typedef struct {
+    i8 reg;     // 寄存器操作数：-1 表示内存操作数
+    i8 base;
+    i8 index;   // -1 表示没有 index
+    i32 disp;
+} opnd_t;
+
+#define REG(r) ((opnd_t){ .reg = (r), .base = -1, .index = -1 })
+#define MEM(b, i, d) ((opnd_t){ .reg = -1, .base = (b), .index = (i), .disp = (d) })
+
+/// @brief 待回填的跳转
+typedef struct {
+    u32 pos;        // rel32 的位置
+    i32 target;     // 目标指令下标：-1 表示尾声
+} fixup_t;
+
+static ir_insn_t *insns;            // 代码块的 IR：由 ir_build 给出
+static u64 ninsns;
+static i32 labels[EMIT_MAX_INSNS];  // 每条指令的机器码偏移：-1 表示还未生成
+static fixup_t fixups[EMIT_MAX_INSNS * 2];
+static u64 nfixups;
+static u64 worklist[EMIT_MAX_INSNS];
+static u64 nwork;
+static u64 coldlist[EMIT_MAX_INSNS * 2];    // 冷的指令：热代码都生成之后再生成
+static u64 ncold;
+static bool emitting_cold;                  // 正在生成冷代码：放在尾声之后
+static i32 trace_next = -1;                 // 顺序生成的下一条指令不是 next 时由跳转给出
+/// 所有 rel32 跳转：冷代码放进冷区之后，热代码与冷代码之间的跳转重新计算
+static struct { u32 at, target; } rels[EMIT_MAX_INSNS * 4];
+static u64 nrels;
+static i8 reg_map[num_gp_regs];     // guest 寄存器所在的主机寄存器：-1 表示在 state 中
+
+static u8 code[EMIT_MAX_INSNS * EMIT_MAX_INSN_BYTES];
+static u64 pos;
+
+static struct {
+    u64 regions;    // 成功翻译的代码块
+    u64 fallbacks;  // 交给 clang 的代码块
+    u64 insns;      // 翻译的指令数
+    u64 ns;         // 翻译耗时
+} stats;
+
+// ============================================================================== //
+// x86-64 编码
+// ============================================================================== //
+
+static inline void b(u8 x) { code[pos++] = x; }
+
+static inline void d32(u32 x) {
+    memcpy(code + pos, &x, 4);
+    pos += 4;
+}
+
+static inline void q64(u64 x) {
+    memcpy(code + pos, &x, 8);
+    pos += 8;
+}
+
+/// @brief REX 前缀：force 用于访问 spl/bpl/sil/dil
+static void rex(bool w, int reg, opnd_t m, bool force) {
+    int rm = m.reg >= 0 ? m.reg : m.base;
+    int x = m.reg < 0 && m.index >= 0 ? m.index : 0;
+    u8 r = 0x40 | (w << 3) | ((reg >> 3) << 2) | ((x >> 3) << 1) | (rm >> 3);
+    if (r != 0x40 || force) b(r);
+}
+
+/// @brief ModRM/SIB/disp：内存操作数总是使用 disp32
+static void modrm(int reg, opnd_t m) {
+    reg &= 7;
+    if (m.reg >= 0) {
+        b(0xc0 | reg << 3 | (m.reg & 7));
+    } else if (m.index >= 0 || (m.base & 7) == RSP) {
+        b(0x84 | reg << 3);
+        b((m.index >= 0 ? (m.index & 7) : RSP) << 3 | (m.base & 7));
+        d32(m.disp);
+    } else {
+        b(0x80 | reg << 3 | (m.base & 7));
+        d32(m.disp);
+    }
+}
+
+/// @brief 带 ModRM 的指令：opcode 最多 3 字节
+static void op_rm(bool w, u32 opcode, int oplen, int reg, opnd_t m) {
+    rex(w, reg, m, false);
+    for (int i = oplen - 1; i >= 0; i--) b(opcode >> (8 * i));
+    modrm(reg, m);
+}
+
+#define OP_ADD 0x03
+#define OP_OR  0x0b
+#define OP_AND 0x23
+#define OP_SUB 0x2b
+#define OP_XOR 0x33
+#define OP_CMP 0x3b
+
+/// 与 OP_* 对应的立即数扩展码
+static int imm_ext(u8 op) {
+    switch (op) {
+    case OP_ADD: return 0;
+    case OP_OR:  return 1;
+    case OP_AND: return 4;
+    case OP_SUB: return 5;
+    case OP_XOR: return 6;
+    case OP_CMP: return 7;
+    default: unreachable();
+    }
+}
+
+#define SH_SHL 4
+#define SH_SHR 5
+#define SH_SAR 7
+
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_L  0xc
+#define CC_GE 0xd
+
+static void mov_r_rm(bool w, int dst, opnd_t m) {
+    if (m.reg == dst && w) return;
+    op_rm(w, 0x8b, 1, dst, m);
+}
+
+static void mov_rm_r(bool w, opnd_t m, int src) {
+    if (m.reg == src && w) return;
+    op_rm(w, 0x89, 1, src, m);
+}
+
+static void alu_r_rm(bool w, u8 op, int dst, opnd_t m) {
+    op_rm(w, op, 1, dst, m);
+}
+
+static void alu_rm_imm(bool w, u8 op, opnd_t m, i32 imm) {
+    if (imm >= -128 && imm <= 127) {
+        op_rm(w, 0x83, 1, imm_ext(op), m);
+        b(imm);
+    } else {
+        op_rm(w, 0x81, 1, imm_ext(op), m);
+        d32(imm);
+    }
+}
+
+static void mov_r_imm(int dst, i64 imm) {
+    if (imm == 0) {
+        op_rm(false, 0x33, 1, dst, REG(dst));       // xor r32, r32
+    } else if (imm == (i32)imm) {
+        op_rm(true, 0xc7, 1, 0, REG(dst));          // mov r/m64, simm32
+        d32(imm);
+    } else {
+        b(0x48 | (dst >> 3));                       // mov r64, imm64
+        b(0xb8 | (dst & 7));
+        q64(imm);
+    }
+}
+
+static void shift_imm(bool w, int ext, int dst, int imm) {
+    op_rm(w, 0xc1, 1, ext, REG(dst));
+    b(imm);
+}
+
+static void shift_cl(bool w, int ext, int dst) {
+    op_rm(w, 0xd3, 1, ext, REG(dst));
+}
+
+/// movsxd dst, src32
+static void sext32(int dst, int src) {
+    op_rm(true, 0x63, 1, dst, REG(src));
+}
+
+/// xor dst32, dst32; cmp ...; setcc dst8
+static void setcc(int cc, int dst) {
+    op_rm(false, 0x0f90 | cc, 2, 0, REG(dst));
+}
+
+static u32 jcc32(int cc) {
+    b(0x0f);
+    b(0x80 | cc);
+    d32(0);
+    return pos - 4;
+}
+
+static u32 jmp32(void) {
+    b(0xe9);
+    d32(0);
+    return pos - 4;
+}
+
+/// 短跳转：返回 rel8 的位置，之后用 patch8 回填
+static u32 jcc8(int cc) {
+    b(0x70 | cc);
+    b(0);
+    return pos - 1;
+}
+
+static u32 jmp8(void) {
+    b(0xeb);
+    b(0);
+    return pos - 1;
+}
+
+static void patch8(u32 at) {
+    code[at] = pos - (at + 1);
+}
+
+static void patch32(u32 at, u64 target) {
+    i32 rel = target - (at + 4);
+    memcpy(code + at, &rel, 4);
+    rels[nrels].at = at;
+    rels[nrels].target = target;
+    nrels++;
+}
+
+static void push_r(int r) {
+    if (r >= R8) b(0x41);
+    b(0x50 | (r & 7));
+}
+
+static void pop_r(int r) {
+    if (r >= R8) b(0x41);
+    b(0x58 | (r & 7));
+}
+
+// ============================================================================== //
+// guest 寄存器访问
+// ============================================================================== //
+
+static opnd_t greg(int r) {
+    if (reg_map[r] >= 0) return REG(reg_map[r]);
+    return MEM(R15, -1, GP_OFF(r));
+}
+
+/// @brief 读 guest 寄存器到主机寄存器
+static void load_greg(int dst, int r) {
+    if (r == zero) mov_r_imm(dst, 0);
+    else mov_r_rm(true, dst, greg(r));
+}
+
+/// @brief 主机寄存器的值写入 guest 寄存器
+static void store_greg(int r, int src) {
+    if (r != zero) mov_rm_r(true, greg(r), src);
+}
+
+/// @brief guest 寄存器作为源操作数：x0 先在 scratch 中置 0
+static opnd_t src_opnd(int r, int scratch) {
+    if (r != zero) return greg(r);
+    mov_r_imm(scratch, 0);
+    return REG(scratch);
+}
+
+/// @brief guest 内存地址 rs1 + imm 对应的主机操作数
+static opnd_t mem_opnd(int rs1, i32 imm) {
+    if (rs1 == zero) return MEM(R14, -1, imm);
+    if (reg_map[rs1] >= 0) return MEM(R14, reg_map[rs1], imm);
+    load_greg(RAX, rs1);
+    return MEM(R14, RAX, imm);
+}
+
+// ============================================================================== //
+// 代码块出口
+// ============================================================================== //
+
+static void add_fixup(u32 at, i32 target) {
+    fixups[nfixups].pos = at;
+    fixups[nfixups].target = target;
+    nfixups++;
+}
+
+/// @brief 跳出代码块：reenter_pc 在 rax 中
+static void exit_rax(enum exit_reason_t reason) {
+    op_rm(false, 0xc7, 1, 0, MEM(R15, -1, STATE_OFF(exit_reason)));
+    d32(reason);
+    mov_rm_r(true, MEM(R15, -1, STATE_OFF(reenter_pc)), RAX);
+    add_fixup(jmp32(), -1);
+}
+
+static void exit_pc(enum exit_reason_t reason, u64 pc) {
+    mov_r_imm(RAX, pc);
+    exit_rax(reason);
+}
+
+/// @brief 记下还要生成的指令：冷的指令等热代码都生成之后再生成
+static void push_target(u64 pc) {
+    if (emitting_cold || ir_cold(pc)) coldlist[ncold++] = pc;
+    else worklist[nwork++] = pc;
+}
+
+/// @brief 跳转到代码块内的指令
+static void jump_to(u64 pc) {
+    i32 idx = ir_find(pc);
+    assert(idx >= 0);
+    if (labels[idx] >= 0) patch32(jmp32(), labels[idx]);
+    else add_fixup(jmp32(), idx);
+}
+
+// ============================================================================== //
+// 校验：记录本地代码的每次写内存，执行后撤销，再与解释器的结果比较
+// ============================================================================== //
+
+typedef struct {
+    u64 addr;   // 主机地址
+    u64 size;
+    u64 old;    // 写入前的值
+    u64 new;    // 本地代码执行后的值
+} store_log_t;
+
+static store_log_t store_log[EMIT_MAX_INSNS];
+static u64 nstore_log;
+
+static void emit_log_store(u64 addr, u64 size) {
+    assert(nstore_log < EMIT_MAX_INSNS);
+    store_log_t *l = &store_log[nstore_log++];
+    l->addr = addr;
+    l->size = size;
+    l->old = 0;
+    memcpy(&l->old, (void *)addr, size);
+}
+
+// ============================================================================== //
+// 指令选择
+// ============================================================================== //
+
+/// @brief rd = rs1 op rs2
+static void emit_alu(insn_t *insn, bool w, u8 op) {
+    load_greg(RAX, insn->rs1);
+    alu_r_rm(w, op, RAX, src_opnd(insn->rs2, RCX));
+    if (!w) sext32(RAX, RAX);
+    store_greg(insn->rd, RAX);
+}
+
+/// @brief rd = rs1 op imm
+static void emit_alu_imm(insn_t *insn, bool w, u8 op) {
+    if (insn->rs1 == zero && w && op != OP_AND) {
+        mov_r_imm(RAX, insn->imm);      // li
+    } else {
+        load_greg(RAX, insn->rs1);
+        alu_rm_imm(w, op, REG(RAX), insn->imm);
+        if (!w) sext32(RAX, RAX);
+    }
+    store_greg(insn->rd, RAX);
+}
+
+static void emit_shift(insn_t *insn, bool w, int ext) {
+    load_greg(RCX, insn->rs2);
+    load_greg(RAX, insn->rs1);
+    shift_cl(w, ext, RAX);
+    if (!w) sext32(RAX, RAX);
+    store_greg(insn->rd, RAX);
+}
+
+static void emit_shift_imm(insn_t *insn, bool w, int ext) {
+    load_greg(RAX, insn->rs1);
+    shift_imm(w, ext, RAX, insn->imm & (w ? 0x3f : 0x1f));
+    if (!w) sext32(RAX, RAX);
+    store_greg(insn->rd, RAX);
+}
+
+static void emit_slt(insn_t *insn, int cc, bool imm) {
+    load_greg(RAX, insn->rs1);
+    mov_r_imm(RDX, 0);
+    if (imm) alu_rm_imm(true, OP_CMP, REG(RAX), insn->imm);
+    else alu_r_rm(true, OP_CMP, RAX, src_opnd(insn->rs2, RCX));
+    setcc(cc, RDX);
+    store_greg(insn->rd, RDX);
+}
+
+/**
+ * 除法：除数为 0 与溢出时 x86 会触发异常，按 RISC-V 的规定处理
+ *     div:  rs2 == 0 -> -1，    rs2 == -1 -> -rs1（INT_MIN / -1 = INT_MIN）
+ *     rem:  rs2 == 0 -> rs1，   rs2 == -1 -> 0
+ */
+static void emit_div(insn_t *insn, bool w, bool sign, bool rem) {
+    load_greg(RAX, insn->rs1);
+    load_greg(RCX, insn->rs2);
+    op_rm(w, 0x85, 1, RCX, REG(RCX));           // test rcx, rcx
+    u32 to_zero = jcc8(CC_E);
+    u32 to_neg1 = 0;
+    if (sign) {
+        alu_rm_imm(w, OP_CMP, REG(RCX), -1);
+        to_neg1 = jcc8(CC_E);
+        if (w) b(0x48);
+        b(0x99);                                // cqo / cdq
+        op_rm(w, 0xf7, 1, 7, REG(RCX));         // idiv
+    } else {
+        mov_r_imm(RDX, 0);
+        op_rm(w, 0xf7, 1, 6, REG(RCX));         // div
+    }
+    if (rem) mov_r_rm(true, RAX, REG(RDX));
+    u32 to_done = jmp8();
+    u32 to_done2 = 0;
+
+    if (sign) {
+        patch8(to_neg1);
+        if (rem) mov_r_imm(RAX, 0);
+        else op_rm(w, 0xf7, 1, 3, REG(RAX));    // neg
+        to_done2 = jmp8();
+    }
+
+    patch8(to_zero);
+    if (!rem) mov_r_imm(RAX, -1);
+
+    patch8(to_done);
+    if (sign) patch8(to_done2);
+    if (!w) sext32(RAX, RAX);
+    store_greg(insn->rd, RAX);
+}
+
+static void emit_mulh(insn_t *insn, enum insn_type_t type) {
+    load_greg(RAX, insn->rs1);
+    load_greg(RCX, insn->rs2);
+    if (type == insn_mulhsu) {
+        // 有符号 × 无符号：无符号乘积的高位，rs1 为负时再减去 rs2
+        mov_r_rm(true, RSI, REG(RAX));
+        shift_imm(true, SH_SAR, RSI, 63);
+        alu_r_rm(true, OP_AND, RSI, REG(RCX));
+    }
+    op_rm(true, 0xf7, 1, type == insn_mulh ? 5 : 4, REG(RCX));     // imul / mul
+    if (type == insn_mulhsu) alu_r_rm(true, OP_SUB, RDX, REG(RSI));
+    store_greg(insn->rd, RDX);
+}
+
+static void emit_load(insn_t *insn, u32 opcode, int oplen, bool w) {
+    opnd_t m = mem_opnd(insn->rs1, insn->imm);
+    op_rm(w, opcode, oplen, RAX, m);
+    store_greg(insn->rd, RAX);
+}
+
+static void emit_store(insn_t *insn, int size) {
+    if (EMIT_VERIFY) {
+        op_rm(true, 0x8d, 1, RDI, mem_opnd(insn->rs1, insn->imm));     // lea
+        mov_r_imm(RSI, size);
+        mov_r_imm(RAX, (u64)emit_log_store);
+        op_rm(false, 0xff, 1, 2, REG(RAX));                            // call rax
+    }
+
+    int src = RCX;
+    if (insn->rs2 != zero && reg_map[insn->rs2] >= 0) src = reg_map[insn->rs2];
+    else load_greg(RCX, insn->rs2);
+    opnd_t m = mem_opnd(insn->rs1, insn->imm);
+
+    switch (size) {
+    case 1: rex(false, src, m, true); b(0x88); modrm(src, m); break;
+    case 2: b(0x66); op_rm(false, 0x89, 1, src, m); break;
+    case 4: op_rm(false, 0x89, 1, src, m); break;
+    case 8: op_rm(true, 0x89, 1, src, m); break;
+    default: unreachable();
+    }
+}
+
+static int branch_cc(enum insn_type_t type) {
+    switch (type) {
+    case insn_beq:  return CC_E;
+    case insn_bne:  return CC_NE;
+    case insn_blt:  return CC_L;
+    case insn_bge:  return CC_GE;
+    case insn_bltu: return CC_B;
+    case insn_bgeu: return CC_AE;
+    default: unreachable();
+    }
+}
+
+static void emit_branch(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    u64 target = e->pc + (i64)insn->imm;
+    load_greg(RAX, insn->rs1);
+    alu_r_rm(true, OP_CMP, RAX, src_opnd(insn->rs2, RCX));
+    int cc = branch_cc(insn->type);
+    if (EMIT_VERIFY) {
+        // 与解释器一致：跳转时跳出代码块
+        u32 skip = jcc8(cc ^ 1);
+        exit_pc(direct_branch, target);
+        patch8(skip);
+        return;
+    }
+
+    i32 idx = ir_find(target);
+    assert(idx >= 0);
+    // 顺序执行的一边是冷的：条件取反跳到冷代码，热的一边接着生成
+    i32 next = e->next;
+    if (!emitting_cold && next >= 0 && insns[next].cold && labels[next] < 0 &&
+        !insns[idx].cold && labels[idx] < 0) {
+        add_fixup(jcc32(cc ^ 1), next);
+        coldlist[ncold++] = insns[next].pc;
+        trace_next = idx;
+        return;
+    }
+    if (labels[idx] >= 0) {
+        patch32(jcc32(cc), labels[idx]);
+    } else {
+        add_fixup(jcc32(cc), idx);
+        push_target(target);
+    }
+}
+
+static void emit_ecall(ir_insn_t *e) {
+    if (EMIT_VERIFY) {
+        exit_pc(ecall, e->pc + 4);
+        return;
+    }
+    // syscall 只读 a0-a7，其余缓存在主机寄存器中的 guest 寄存器不需要写回
+    for (int r = a0; r <= a7; r++)
+        if (reg_map[r] >= 0) mov_rm_r(true, MEM(R15, -1, GP_OFF(r)), reg_map[r]);
+    mov_r_rm(true, RDI, REG(R15));
+    op_rm(false, 0xff, 1, 2, MEM(R15, -1, STATE_OFF(syscall)));    // call [r15 + syscall]
+    store_greg(a0, RAX);
+}
+
+/// @brief 翻译一条指令
+/// @return 是否顺序执行下一条指令
+static bool emit_insn(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    u64 next_pc = e->pc + insn->len;
+
+    switch (e->kind) {
+    case ir_exit:
+        exit_pc(e->reason, e->val);
+        return false;
+    case ir_li:
+        if (reg_map[insn->rd] >= 0) {
+            mov_r_imm(reg_map[insn->rd], e->val);
+        } else {
+            mov_r_imm(RAX, e->val);
+            store_greg(insn->rd, RAX);
+        }
+        return true;
+    case ir_mv:
+        if (reg_map[insn->rd] >= 0) {
+            mov_r_rm(true, reg_map[insn->rd], greg(insn->rs1));
+        } else {
+            load_greg(RAX, insn->rs1);
+            store_greg(insn->rd, RAX);
+        }
+        return true;
+    case ir_nop:
+        return true;
+    case ir_insn:
+        break;
+    }
+
+    switch (insn->type) {
+    case insn_lb:  emit_load(insn, 0x0fbe, 2, true); break;
+    case insn_lh:  emit_load(insn, 0x0fbf, 2, true); break;
+    case insn_lw:  emit_load(insn, 0x63, 1, true); break;
+    case insn_ld:  emit_load(insn, 0x8b, 1, true); break;
+    case insn_lbu: emit_load(insn, 0x0fb6, 2, false); break;
+    case insn_lhu: emit_load(insn, 0x0fb7, 2, false); break;
+    case insn_lwu: emit_load(insn, 0x8b, 1, false); break;
+    case insn_fence:
+    case insn_fence_i: break;
+    case insn_addi:  emit_alu_imm(insn, true, OP_ADD); break;
+    case insn_xori:  emit_alu_imm(insn, true, OP_XOR); break;
+    case insn_ori:   emit_alu_imm(insn, true, OP_OR); break;
+    case insn_andi:  emit_alu_imm(insn, true, OP_AND); break;
+    case insn_addiw: emit_alu_imm(insn, false, OP_ADD); break;
+    case insn_slti:  emit_slt(insn, CC_L, true); break;
+    case insn_sltiu: emit_slt(insn, CC_B, true); break;
+    case insn_slli:  emit_shift_imm(insn, true, SH_SHL); break;
+    case insn_srli:  emit_shift_imm(insn, true, SH_SHR); break;
+    case insn_srai:  emit_shift_imm(insn, true, SH_SAR); break;
+    case insn_slliw: emit_shift_imm(insn, false, SH_SHL); break;
+    case insn_srliw: emit_shift_imm(insn, false, SH_SHR); break;
+    case insn_sraiw: emit_shift_imm(insn, false, SH_SAR); break;
+    case insn_auipc:
+        mov_r_imm(RAX, e->pc + (i64)insn->imm);
+        store_greg(insn->rd, RAX);
+        break;
+    case insn_lui:
+        mov_r_imm(RAX, (i64)insn->imm);
+        store_greg(insn->rd, RAX);
+        break;
+    case insn_zext:
+        load_greg(RAX, insn->rs1);
+        if ((insn->imm & 0x3f) == 32) {
+            mov_r_rm(false, RAX, REG(RAX));     // mov eax, eax
+        } else {
+            shift_imm(true, SH_SHL, RAX, insn->imm & 0x3f);
+            shift_imm(true, SH_SHR, RAX, insn->imm & 0x3f);
+        }
+        store_greg(insn->rd, RAX);
+        break;
+    case insn_ld_pc:
+        mov_r_imm(RAX, e->pc + (i64)insn->imm);
+        op_rm(true, 0x8b, 1, RAX, MEM(R14, RAX, 0));
+        store_greg(insn->rd, RAX);
+        break;
+    case insn_sb: emit_store(insn, 1); break;
+    case insn_sh: emit_store(insn, 2); break;
+    case insn_sw: emit_store(insn, 4); break;
+    case insn_sd: emit_store(insn, 8); break;
+    case insn_add:  emit_alu(insn, true, OP_ADD); break;
+    case insn_sub:  emit_alu(insn, true, OP_SUB); break;
+    case insn_xor:  emit_alu(insn, true, OP_XOR); break;
+    case insn_or:   emit_alu(insn, true, OP_OR); break;
+    case insn_and:  emit_alu(insn, true, OP_AND); break;
+    case insn_addw: emit_alu(insn, false, OP_ADD); break;
+    case insn_subw: emit_alu(insn, false, OP_SUB); break;
+    case insn_slt:  emit_slt(insn, CC_L, false); break;
+    case insn_sltu: emit_slt(insn, CC_B, false); break;
+    case insn_sll:  emit_shift(insn, true, SH_SHL); break;
+    case insn_srl:  emit_shift(insn, true, SH_SHR); break;
+    case insn_sra:  emit_shift(insn, true, SH_SAR); break;
+    case insn_sllw: emit_shift(insn, false, SH_SHL); break;
+    case insn_srlw: emit_shift(insn, false, SH_SHR); break;
+    case insn_sraw: emit_shift(insn, false, SH_SAR); break;
+    case insn_mul:
+    case insn_mulw:
+        load_greg(RAX, insn->rs1);
+        op_rm(insn->type == insn_mul, 0x0faf, 2, RAX, src_opnd(insn->rs2, RCX));
+        if (insn->type == insn_mulw) sext32(RAX, RAX);
+        store_greg(insn->rd, RAX);
+        break;
+    case insn_mulh:
+    case insn_mulhsu:
+    case insn_mulhu: emit_mulh(insn, insn->type); break;
+    case insn_div:   emit_div(insn, true, true, false); break;
+    case insn_divu:  emit_div(insn, true, false, false); break;
+    case insn_rem:   emit_div(insn, true, true, true); break;
+    case insn_remu:  emit_div(insn, true, false, true); break;
+    case insn_divw:  emit_div(insn, false, true, false); break;
+    case insn_divuw: emit_div(insn, false, false, false); break;
+    case insn_remw:  emit_div(insn, false, true, true); break;
+    case insn_remuw: emit_div(insn, false, false, true); break;
+    case insn_beq:
+    case insn_bne:
+    case insn_blt:
+    case insn_bge:
+    case insn_bltu:
+    case insn_bgeu: emit_branch(e); break;
+    case insn_jal: {
+        u64 target = e->pc + (i64)insn->imm;
+        if (insn->rd != zero) {
+            mov_r_imm(RAX, next_pc);
+            store_greg(insn->rd, RAX);
+        }
+        if (EMIT_VERIFY) {
+            exit_pc(direct_branch, target);
+        } else {
+            i32 idx = ir_find(target);
+            if (labels[idx] < 0) push_target(target);
+            jump_to(target);
+        }
+        return false;
+    }
+    case insn_jalr:
+        load_greg(RAX, insn->rs1);
+        alu_rm_imm(true, OP_ADD, REG(RAX), insn->imm);
+        alu_rm_imm(true, OP_AND, REG(RAX), -2);
+        if (insn->rd != zero) {
+            mov_r_imm(RCX, next_pc);
+            store_greg(insn->rd, RCX);
+        }
+        exit_rax(indirect_branch);
+        return false;
+    case insn_ecall:
+        emit_ecall(e);
+        return !EMIT_VERIFY;
+    default:
+        unreachable();
+    }
+    return true;
+}
+
+/// @brief 本地代码生成器支持的指令：RV64IM
+static bool emit_supported(enum insn_type_t type) {
+    return type <= insn_ecall;
+}
+
+// ============================================================================== //
+// 代码块
+// ============================================================================== //
+
+/// @brief 取得代码块的 IR，统计 guest 寄存器的使用次数
+/// @return 是否都能翻译
+static bool emit_discover(u64 start, cache_t *cache, u64 *uses) {
+    // 校验时与解释器的代码块相同：跳转与 ecall 之后结束
+    insns = ir_build(start, EMIT_MAX_INSNS, !EMIT_VERIFY, cache, &ninsns);
+    for (u64 i = 0; i < ninsns; i++) {
+        ir_insn_t *e = &insns[i];
+        labels[i] = -1;
+        // 放不下的代码块交给 clang
+        if (e->kind == ir_exit && e->reason == direct_branch) return false;
+        if (e->kind == ir_exit || e->kind == ir_nop) continue;
+        if (e->kind == ir_insn && !emit_supported(e->insn.type)) return false;
+        // 只数真正读写的寄存器：其他指令的 rd/rs2 字段是 0
+        int ops = ir_operands(e);
+        if (ops & IR_DEF_RD) uses[e->insn.rd]++;
+        if (ops & IR_USE_RS1) uses[e->insn.rs1]++;
+        if (ops & IR_USE_RS2) uses[e->insn.rs2]++;
+    }
+    return true;
+}
+
+/// @brief 使用最多的 guest 寄存器放进主机寄存器
+static void emit_alloc(u64 *uses) {
+    memset(reg_map, -1, sizeof(reg_map));
+    for (u64 i = 0; i < ARRAY_SIZE(cached_regs); i++) {
+        int best = 0;
+        u64 most = 0;
+        for (int r = 1; r < num_gp_regs; r++)
+            if (reg_map[r] < 0 && uses[r] > most) best = r, most = uses[r];
+        if (best == 0) break;
+        reg_map[best] = cached_regs[i];
+    }
+}
+
+/// 序言与尾声保存的被调用者保存寄存器：加上对齐共 7 个，调用时栈 16 字节对齐
+static const i8 saved_regs[] = { RBX, RBP, R12, R13, R14, R15 };
+
+static void emit_prologue(void) {
+    for (u64 i = 0; i < ARRAY_SIZE(saved_regs); i++) push_r(saved_regs[i]);
+    alu_rm_imm(true, OP_SUB, REG(RSP), 8);
+    mov_r_rm(true, R15, REG(RDI));
+    mov_r_imm(R14, GUEST_MEMORY_OFFSET);
+    for (int r = 1; r < num_gp_regs; r++)
+        if (reg_map[r] >= 0) mov_r_rm(true, reg_map[r], MEM(R15, -1, GP_OFF(r)));
+}
+
+static void emit_epilogue(void) {
+    for (int r = 1; r < num_gp_regs; r++)
+        if (reg_map[r] >= 0) mov_rm_r(true, MEM(R15, -1, GP_OFF(r)), reg_map[r]);
+    alu_rm_imm(true, OP_ADD, REG(RSP), 8);
+    for (i64 i = ARRAY_SIZE(saved_regs) - 1; i >= 0; i--) pop_r(saved_regs[i]);
+    b(0xc3);
+}
+
+/// @brief 从 start 开始顺序生成，直到跳出、遇到已生成的指令，或从热代码走到冷代码
+static void emit_trace(u64 start) {
+    i32 idx = ir_find(start);
+    if (labels[idx] >= 0) return;       // 已经由其他路径生成
+    while (true) {
+        if (labels[idx] >= 0) {
+            patch32(jmp32(), labels[idx]);
+            return;
+        }
+        if (insns[idx].cold && !emitting_cold) {
+            add_fixup(jmp32(), idx);
+            coldlist[ncold++] = insns[idx].pc;
+            return;
+        }
+        labels[idx] = pos;
+        if (!emit_insn(&insns[idx])) return;
+        idx = trace_next >= 0 ? trace_next : insns[idx].next;
+        trace_next = -1;
+        assert(idx >= 0);
+    }
+}
+
+/**
+ * 热代码与尾声放进热区，尾声之后的冷代码放进冷区：
+ * 两部分之间的 rel32 跳转按实际地址重新计算，其余跳转都在同一部分内，相对位置不变
+ */
+static u8 *emit_place(machine_t *m, u64 cold) {
+    u8 *hot_addr = cache_alloc(m->cache, code, cold, 16);
+    u8 *cold_addr = cache_alloc_cold(m->cache, code + cold, pos - cold, 16);
+    for (u64 i = 0; i < nrels; i++) {
+        u32 at = rels[i].at, target = rels[i].target;
+        if ((at >= cold) == (target >= cold)) continue;
+        u8 *P = at >= cold ? cold_addr + (at - cold) : hot_addr + at;
+        u8 *T = target >= cold ? cold_addr + (target - cold) : hot_addr + target;
+        i32 rel = T - (P + 4);
+        memcpy(cache_rw(m->cache, P), &rel, 4);
+    }
+    __builtin___clear_cache((char *)hot_addr, (char *)hot_addr + cold);
+    __builtin___clear_cache((char *)cold_addr, (char *)cold_addr + (pos - cold));
+    return hot_addr;
+}
+
+/// 本地代码块：校验时用于区分 clang 生成的代码
+static struct { u8 *code; u64 pc; } natives[EMIT_MAX_INSNS];
+static u64 nnatives;
+
+u8 *machine_emit(machine_t *m) {
+#ifndef __x86_64__
+    return NULL;
+#endif
+    struct timespec t0, t1;
+    if (TEMU_STATS) clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    u64 start = m->state.pc;
+    u64 uses[num_gp_regs] = {0};
+    nfixups = 0;
+    nrels = 0;
+    ncold = 0;
+    emitting_cold = false;
+    pos = 0;
+    if (!emit_discover(start, m->cache, uses)) {
+        stats.fallbacks++;
+        return NULL;
+    }
+    emit_alloc(uses);
+
+    emit_prologue();
+    nwork = 0;
+    worklist[nwork++] = start;
+    while (nwork > 0) emit_trace(worklist[--nwork]);
+
+    u64 epilogue = pos;
+    emit_epilogue();
+    u64 cold = pos;
+    emitting_cold = true;
+    while (ncold > 0) emit_trace(coldlist[--ncold]);
+    for (u64 i = 0; i < nfixups; i++) {
+        fixup_t *f = &fixups[i];
+        patch32(f->pos, f->target < 0 ? epilogue : (u64)labels[f->target]);
+    }
+
+    u8 *ret;
+    if (cold < pos) {
+        ret = emit_place(m, cold);
+        cache_set(m->cache, start, ret);
+    } else {
+        ret = cache_add(m->cache, start, code, pos, 16);
+    }
+    if (EMIT_VERIFY && nnatives < ARRAY_SIZE(natives)) {
+        natives[nnatives].code = ret;
+        natives[nnatives].pc = start;
+        nnatives++;
+    }
+
+    if (TEMU_STATS) {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        stats.regions++;
+        stats.insns += ninsns;
+        stats.ns += (t1.tv_sec - t0.tv_sec) * 1000000000ul + (t1.tv_nsec - t0.tv_nsec);
+    }
+    return ret;
+}
+
+bool emit_is_native(u8 *code) {
+    for (u64 i = 0; i < nnatives; i++)
+        if (natives[i].code == code) return true;
+    return false;
+}
+
+void emit_verify(machine_t *m, u8 *code) {
+    u64 start = 0;
+    for (u64 i = 0; i < nnatives; i++)
+        if (natives[i].code == code) start = natives[i].pc;
+    assert(start != 0);
+
+    state_t before = m->state;
+    nstore_log = 0;
+    ((exec_block_func_t)code)(&m->state);
+    state_t native = m->state;
+    // 第一条指令就交给解释器：没有执行任何指令
+    if (native.exit_reason == interp && native.reenter_pc == start) return;
+
+    // 撤销本地代码的写入
+    for (u64 i = 0; i < nstore_log; i++)
+        memcpy(&store_log[i].new, (void *)store_log[i].addr, store_log[i].size);
+    for (i64 i = nstore_log - 1; i >= 0; i--)
+        memcpy((void *)store_log[i].addr, &store_log[i].old, store_log[i].size);
+
+    m->state = before;
+    m->state.pc = start;
+    if (native.exit_reason == interp) {
+        // 本地代码在 reenter_pc 处交给解释器：之前的指令都顺序执行，解释器逐条执行到那里再对照
+        while (m->state.pc != native.reenter_pc) {
+            if (exec_insn_interp(&m->state))
+                fatalf("emit: block %lx: interp left the block before %lx", start, native.reenter_pc);
+        }
+        m->state.reenter_pc = native.reenter_pc;
+    } else {
+        exec_block_interp(&m->state);
+    }
+
+    for (int r = 1; r < num_gp_regs; r++) {
+        if (native.gp_regs[r] != m->state.gp_regs[r])
+            fatalf("emit: block %lx: x%d = %lx, interp %lx",
+                   start, r, native.gp_regs[r], m->state.gp_regs[r]);
+    }
+    if (native.reenter_pc != m->state.reenter_pc)
+        fatalf("emit: block %lx: reenter_pc = %lx, interp %lx",
+               start, native.reenter_pc, m->state.reenter_pc);
+    for (u64 i = 0; i < nstore_log; i++) {
+        u64 val = 0;
+        memcpy(&val, (void *)store_log[i].addr, store_log[i].size);
+        if (val != store_log[i].new)
+            fatalf("emit: block %lx: store %lx = %lx, interp %lx",
+                   start, store_log[i].addr, store_log[i].new, val);
+    }
+    m->state.exit_reason = native.exit_reason;
+}
+
+void emit_report(void) {
+    if (stats.regions == 0) return;
+    fprintf(stderr, "emit: %lu regions, %lu insns, %.2f us/region, %lu fallbacks\n",
+            stats.regions, stats.insns, stats.ns / 1e3 / stats.regions, stats.fallbacks);
+}
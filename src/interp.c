@@ -5,6 +5,8 @@
 
 #include "temu.h"
 
+#include <xmmintrin.h>
+
 #include "interp_util.h"
 
 
@@ -358,41 +360,97 @@ static void func_bgeu(state_t *state, insn_t *insn) {
 
 static void func_jalr(state_t *state, insn_t *insn) {
     u64 rs1 = state->gp_regs[insn->rs1];
-    state->gp_regs[insn->rd] = state->pc + (insn->rvc ? 2 : 4);
+    state->gp_regs[insn->rd] = state->pc + insn->len;
     state->exit_reason = indirect_branch;
     state->reenter_pc = (rs1 + (i64)insn->imm) & ~(u64)1;
 }
 
 static void func_jal(state_t *state, insn_t *insn) {
-    state->gp_regs[insn->rd] = state->pc + (insn->rvc ? 2 : 4);
+    state->gp_regs[insn->rd] = state->pc + insn->len;
     state->reenter_pc = state->pc = state->pc + (i64)insn->imm;
     state->exit_reason = direct_branch;
 }
 
+/// slli + srli：保留低 64 - imm 位
+static void func_zext(state_t *state, insn_t *insn) {
+    u64 rs1 = state->gp_regs[insn->rs1];
+    state->gp_regs[insn->rd] = (rs1 << (insn->imm & 0x3f)) >> (insn->imm & 0x3f);
+}
+
+/// auipc + ld：读取 pc 相对地址
+static void func_ld_pc(state_t *state, insn_t *insn) {
+    u64 addr = state->pc + (i64)insn->imm;
+    state->gp_regs[insn->rd] = *(i64 *)TO_HOST(addr);
+}
+
 static void func_ecall(state_t *state, insn_t *insn) {
     state->exit_reason = ecall;
     state->reenter_pc = state->pc + 4;
 }
 
-/**
- * TODO: softfloat实现
-*/
-#define FUNC()                         \
-    switch (insn->csr) {               \
-    case fflags:                       \
-    case frm:                          \
-    case fcsr:                         \
-        break;                         \
-    default: fatal("unsupported csr"); \
-    }                                  \
-    state->gp_regs[insn->rd] = 0;      \
-
-static void func_csrrw(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrs(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrc(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrwi(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrsi(state_t *state, insn_t *insn) { FUNC(); }
-static void func_csrrci(state_t *state, insn_t *insn) { FUNC(); }
+/// fflags 各位对应的 MXCSR 异常标志：NX UF OF DZ NV
+static const u32 mxcsr_flags[] = { 0x20, 0x10, 0x08, 0x04, 0x01 };
+/// frm 对应的 MXCSR 舍入方式：RNE RTZ RDN RUP，RMM 没有对应的方式，按 RNE
+static const u32 mxcsr_rc[8] = { 0x0000, 0x6000, 0x2000, 0x4000 };
+#define MXCSR_FLAGS 0x003f
+#define MXCSR_RC    0x6000
+
+/// 主机的 MXCSR：执行客户代码时保存在这里
+static u32 host_mxcsr;
+
+void fenv_enter(state_t *state) {
+    host_mxcsr = _mm_getcsr();
+    _mm_setcsr(state->mxcsr);
+}
+
+void fenv_leave(state_t *state) {
+    state->mxcsr = _mm_getcsr();
+    _mm_setcsr(host_mxcsr);
+}
+
+/// @brief 读 fcsr：浮点指令不更新 fflags，读的时候再从 MXCSR 的异常标志得到
+static u32 fcsr_read(state_t *state) {
+    u32 mxcsr = _mm_getcsr(), flags = 0;
+    for (u64 i = 0; i < ARRAY_SIZE(mxcsr_flags); i++)
+        if (mxcsr & mxcsr_flags[i]) flags |= 1 << i;
+    return state->fcsr | flags;
+}
+
+/// @brief 写 fcsr：清除 MXCSR 的异常标志，按 frm 设置 MXCSR 的舍入方式
+static void fcsr_write(state_t *state, u32 val) {
+    state->fcsr = val & 0xff;
+    u32 mxcsr = _mm_getcsr() & ~(MXCSR_FLAGS | MXCSR_RC);
+    _mm_setcsr(mxcsr | mxcsr_rc[val >> 5 & 7]);
+}
+
+/// @brief 读写 csr：rd 得到旧值，write 为真时写入 expr
+#define FUNC(src, write, expr)                                      \
+    u32 v = fcsr_read(state), old;                                  \
+    switch (insn->csr) {                                            \
+    case fflags: old = v & 0x1f; break;                             \
+    case frm:    old = v >> 5;   break;                             \
+    case fcsr:   old = v;        break;                             \
+    default: fatal("unsupported csr");                              \
+    }                                                               \
+    u64 val = (src);                                                \
+    if (write) {                                                    \
+        val = (expr);                                               \
+        switch (insn->csr) {                                        \
+        case fflags: v = (v & ~0x1f) | (val & 0x1f); break;         \
+        case frm:    v = (v & 0x1f) | (val & 7) << 5; break;        \
+        case fcsr:   v = val; break;                                \
+        }                                                           \
+        fcsr_write(state, v);                                       \
+    }                                                               \
+    state->gp_regs[insn->rd] = old;                                 \
+
+/// csrrs/csrrc 的 rs1 为 x0 时只读不写：立即数版本同样看 rs1 字段
+static void func_csrrw(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], true, val); }
+static void func_csrrs(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], insn->rs1, old | val); }
+static void func_csrrc(state_t *state, insn_t *insn) { FUNC(state->gp_regs[insn->rs1], insn->rs1, old & ~val); }
+static void func_csrrwi(state_t *state, insn_t *insn) { FUNC(insn->rs1, true, val); }
+static void func_csrrsi(state_t *state, insn_t *insn) { FUNC(insn->rs1, insn->rs1, old | val); }
+static void func_csrrci(state_t *state, insn_t *insn) { FUNC(insn->rs1, insn->rs1, old & ~val); }
 
 #undef FUNC
 
@@ -419,50 +477,56 @@ static void func_fsd(state_t *state, insn_t *insn) {
 
 #undef FUNC
 
-#define FUNC(expr)                            \
+/**
+ * 融合乘加：只舍入一次，不能写成 rs1 * rs2 + rs3
+ * 默认调用 libm 的 fma，主机支持 FMA 指令时由 interp_init 换成 _host 版本
+ */
+#define FMA_FUNCS(attr, suffix)                                                     \
+    static attr void func_fmadd_s##suffix(state_t *state, insn_t *insn) {           \
+        FUNC_S(fmaf(rs1, rs2, rs3));                                                \
+    }                                                                               \
+    static attr void func_fmsub_s##suffix(state_t *state, insn_t *insn) {           \
+        FUNC_S(fmaf(rs1, rs2, -rs3));                                               \
+    }                                                                               \
+    static attr void func_fnmsub_s##suffix(state_t *state, insn_t *insn) {          \
+        FUNC_S(fmaf(-rs1, rs2, rs3));                                               \
+    }                                                                               \
+    static attr void func_fnmadd_s##suffix(state_t *state, insn_t *insn) {          \
+        FUNC_S(fmaf(-rs1, rs2, -rs3));                                              \
+    }                                                                               \
+    static attr void func_fmadd_d##suffix(state_t *state, insn_t *insn) {           \
+        FUNC_D(fma(rs1, rs2, rs3));                                                 \
+    }                                                                               \
+    static attr void func_fmsub_d##suffix(state_t *state, insn_t *insn) {           \
+        FUNC_D(fma(rs1, rs2, -rs3));                                                \
+    }                                                                               \
+    static attr void func_fnmsub_d##suffix(state_t *state, insn_t *insn) {          \
+        FUNC_D(fma(-rs1, rs2, rs3));                                                \
+    }                                                                               \
+    static attr void func_fnmadd_d##suffix(state_t *state, insn_t *insn) {          \
+        FUNC_D(fma(-rs1, rs2, -rs3));                                               \
+    }                                                                               \
+
+#define FUNC_S(expr)                          \
     f32 rs1 = state->fp_regs[insn->rs1].f;    \
     f32 rs2 = state->fp_regs[insn->rs2].f;    \
     f32 rs3 = state->fp_regs[insn->rs3].f;    \
-    state->fp_regs[insn->rd].f = (f32)(expr); \
+    state->fp_regs[insn->rd].f = (expr);      \
 
-static void func_fmadd_s(state_t *state, insn_t *insn) {
-    FUNC(rs1 * rs2 + rs3);
-}
+#define FUNC_D(expr)                          \
+    f64 rs1 = state->fp_regs[insn->rs1].d;    \
+    f64 rs2 = state->fp_regs[insn->rs2].d;    \
+    f64 rs3 = state->fp_regs[insn->rs3].d;    \
+    state->fp_regs[insn->rd].d = (expr);      \
 
-static void func_fmsub_s(state_t *state, insn_t *insn) {
-    FUNC(rs1 * rs2 - rs3);
-}
+FMA_FUNCS(, )
+#if HOST_FMA
+FMA_FUNCS(__attribute__((target("fma"))), _host)
+#endif
 
-static void func_fnmsub_s(state_t *state, insn_t *insn) {
-    FUNC(-(rs1 * rs2) + rs3);
-}
-
-static void func_fnmadd_s(state_t *state, insn_t *insn) {
-    FUNC(-(rs1 * rs2) - rs3);
-}
-
-#undef FUNC
-
-#define FUNC(expr)                         \
-    f64 rs1 = state->fp_regs[insn->rs1].d; \
-    f64 rs2 = state->fp_regs[insn->rs2].d; \
-    f64 rs3 = state->fp_regs[insn->rs3].d; \
-    state->fp_regs[insn->rd].d = (expr);   \
-
-static void func_fmadd_d(state_t *state, insn_t *insn) {
-    FUNC(rs1 * rs2 + rs3);
-}
-static void func_fmsub_d(state_t *state, insn_t *insn) {
-    FUNC(rs1 * rs2 - rs3);
-}
-static void func_fnmsub_d(state_t *state, insn_t *insn) {
-    FUNC(-(rs1 * rs2) + rs3);
-}
-static void func_fnmadd_d(state_t *state, insn_t *insn) {
-    FUNC(-(rs1 * rs2) - rs3);
-}
-
-#undef FUNC
+#undef FUNC_S
+#undef FUNC_D
+#undef FMA_FUNCS
 
 #define FUNC(expr)                                                 \
     f32 rs1 = state->fp_regs[insn->rs1].f;                         \
@@ -777,13 +841,15 @@ static func_t *funcs[] = {
     func_bgeu,
     func_jalr,
     func_jal,
+    func_zext,
+    func_ld_pc,
     func_ecall,
-    func_csrrw,
-    func_csrrs,
     func_csrrc,
-    func_csrrwi,
-    func_csrrsi,
     func_csrrci,
+    func_csrrs,
+    func_csrrsi,
+    func_csrrw,
+    func_csrrwi,
     func_flw,
     func_fsw,
     func_fmadd_s,
@@ -848,17 +914,55 @@ static func_t *funcs[] = {
     func_fmv_d_x,
 };
 
+bool host_has_fma(void) {
+#if HOST_FMA
+    static int fma = -1;
+    if (fma < 0) {
+        __builtin_cpu_init();
+        fma = __builtin_cpu_supports("fma");
+    }
+    return fma;
+#else
+    return false;
+#endif
+}
+
+void interp_init(void) {
+#if HOST_FMA
+    if (!host_has_fma()) return;
+    funcs[insn_fmadd_s] = func_fmadd_s_host;
+    funcs[insn_fmsub_s] = func_fmsub_s_host;
+    funcs[insn_fnmsub_s] = func_fnmsub_s_host;
+    funcs[insn_fnmadd_s] = func_fnmadd_s_host;
+    funcs[insn_fmadd_d] = func_fmadd_d_host;
+    funcs[insn_fmsub_d] = func_fmsub_d_host;
+    funcs[insn_fnmsub_d] = func_fnmsub_d_host;
+    funcs[insn_fnmadd_d] = func_fnmadd_d_host;
+#endif
+}
+
+/// @brief 解释执行 pc 处的一条指令
+/// @return 是否跳出代码块：否则 pc 已步进到下一条指令
+static inline bool exec_insn(state_t *state, insn_t *insn) {
+    u32 data = *(u32 *)TO_HOST(state->pc);
+    insn_decode(insn, data);            // 指令解码
+    if (INSN_FUSE) insn_fuse(insn, (u16 *)TO_HOST(state->pc + insn->len));
+    funcs[insn->type](state, insn);     // 匹配执行
+    // zero寄存器清零
+    state->gp_regs[zero] = 0;
+    // 如果指令继续执行，则跳出循环
+    if (insn->cont) return true;
+    // 步进指令长度：压缩指令 2，融合指令为两条之和
+    state->pc += insn->len;
+    return false;
+}
+
 void exec_block_interp(state_t *state) {
     static insn_t insn = {0};
-    while(true) {   // 内存循环
-        u32 data = *(u32 *)TO_HOST(state->pc);
-        insn_decode(&insn, data);           // 指令解码
-        funcs[insn.type](state, &insn);     // 匹配执行
-        // zero寄存器清零
-        state->gp_regs[zero] = 0;
-        // 如果指令继续执行，则跳出循环
-        if(insn.cont) break;                
-        // 如果为压缩指令步进2，否则步进4
-        state->pc += insn.rvc ? 2 : 4;       
-    }
+    while (!exec_insn(state, &insn)) {}     // 内存循环
+}
+
+bool exec_insn_interp(state_t *state) {
+    insn_t insn = {0};
+    return exec_insn(state, &insn);
 }
\ No newline at end of file
@@ -0,0 +1,860 @@
+/**
+ * \file src/ir.c
+ * \brief 中间表示：发现代码块中的指令，在翻译之前做局部优化，供各个后端共用
+ */
+
+#include "temu.h"
+
+// ============================================================================== //
+// 代码块的指令按发现顺序存放，顺序执行的后继由 next 给出。
+// 基本块以 leader 开头：代码块起点、跳转目标、jal/jalr/ecall 之后的指令。
+// 优化只在基本块内进行：寄存器的每次定值是一个 SSA 值，记为 (寄存器, 版本)；
+// 基本块入口处的寄存器值都未知，出口处所有寄存器都是活跃的。
+// ============================================================================== //
+
+/// pc 到指令下标的哈希表大小：2 的幂，至少是 IR_MAX_INSNS 的两倍
+#define IR_MAP_SIZE (2 * IR_MAX_INSNS)
+
+#define SYS_exit       93
+#define SYS_exit_group 94
+
+static ir_insn_t insns[IR_MAX_INSNS];
+static u64 ninsns;
+static struct { u64 pc; u32 gen; i32 idx; } map[IR_MAP_SIZE];
+static u32 map_gen;
+static u64 worklist[IR_MAX_INSNS];
+static u64 nwork;
+static u8 npreds[IR_MAX_INSNS];     // 顺序执行到这条指令的前驱数
+static i32 block[IR_MAX_INSNS];     // 当前基本块的指令下标
+static u64 nblock;
+static ir_slot_t slots[IR_MAX_SLOTS];
+static u64 nslots;
+static u64 avail_out[IR_MAX_INSNS]; // 指令执行后与内存一致的栈槽
+static u64 anticipated[IR_MAX_INSNS];
+
+static struct {
+    u64 regions;
+    u64 insns;
+    u64 folded;     // 折叠成常量或改写成立即数形式的指令
+    u64 copies;     // 化简成复制的指令
+    u64 dead;       // 删除的指令
+    u64 promoted;   // 改为读局部变量的栈槽读取
+} stats;
+
+// ============================================================================== //
+// pc 到指令下标的映射
+// ============================================================================== //
+
+i32 ir_find(u64 pc) {
+    for (u64 i = (pc >> 1) & (IR_MAP_SIZE - 1);; i = (i + 1) & (IR_MAP_SIZE - 1)) {
+        if (map[i].gen != map_gen) return -1;
+        if (map[i].pc == pc) return map[i].idx;
+    }
+}
+
+static void map_add(u64 pc, i32 idx) {
+    u64 i = (pc >> 1) & (IR_MAP_SIZE - 1);
+    while (map[i].gen == map_gen) i = (i + 1) & (IR_MAP_SIZE - 1);
+    map[i].pc = pc;
+    map[i].gen = map_gen;
+    map[i].idx = idx;
+}
+
+// ============================================================================== //
+// 发现代码块
+// ============================================================================== //
+
+static ir_insn_t *ir_append(u64 pc) {
+    ir_insn_t *e = &insns[ninsns];
+    memset(e, 0, sizeof(*e));
+    e->pc = pc;
+    e->next = -1;
+    map_add(pc, ninsns++);
+    return e;
+}
+
+static void ir_set_exit(ir_insn_t *e, enum exit_reason_t reason, u64 pc) {
+    e->kind = ir_exit;
+    e->reason = reason;
+    e->val = pc;
+}
+
+static bool is_branch(enum insn_type_t type) {
+    return type >= insn_beq && type <= insn_bgeu;
+}
+
+/// @brief 沿顺序执行与直接跳转展开：与原来各个后端的发现过程相同
+static void ir_discover(u64 start, u64 max, bool trace) {
+    nwork = 0;
+    worklist[nwork++] = start;
+    while (nwork > 0) {
+        u64 pc = worklist[--nwork];
+        bool a7_known = false;      // 上一条指令是 li a7, N
+        i64 a7_val = 0;
+        while (ir_find(pc) < 0) {
+            // 给工作表中的每个 pc 留一个位置：放不下时从这里跳出代码块
+            if (ninsns + nwork + 3 > max) {
+                ir_set_exit(ir_append(pc), direct_branch, pc);
+                break;
+            }
+            ir_insn_t *e = ir_append(pc);
+
+            u32 data = *(u32 *)TO_HOST(pc);
+            // 全 0 是非法指令，通常是填充：交给解释器，真正执行到时才报错
+            if ((u16)data == 0) {
+                ir_set_exit(e, interp, pc);
+                break;
+            }
+            insn_decode(&e->insn, data);
+            insn_t *insn = &e->insn;
+            if (INSN_FUSE) insn_fuse(insn, (u16 *)TO_HOST(pc + insn->len));
+            // 读写 fcsr 交给解释器：跳出时之前的浮点运算都已完成，异常标志都在 MXCSR 中
+            if (insn->type >= insn_csrrc && insn->type <= insn_csrrwi) {
+                ir_set_exit(e, interp, pc);
+                break;
+            }
+
+            if (is_branch(insn->type)) {
+                if (trace) worklist[nwork++] = pc + (i64)insn->imm;
+            } else if (insn->type == insn_jal) {
+                if (trace) worklist[nwork++] = pc + (i64)insn->imm;
+                break;
+            } else if (insn->type == insn_jalr) {
+                break;
+            } else if (insn->type == insn_ecall) {
+                // 退出类系统调用之后往往不是指令
+                if (a7_known && (a7_val == SYS_exit || a7_val == SYS_exit_group)) {
+                    ir_set_exit(e, ecall, pc + 4);
+                    break;
+                }
+                if (!trace) break;
+            }
+
+            a7_known = insn->type == insn_addi && insn->rd == a7 && insn->rs1 == zero;
+            a7_val = insn->imm;
+            pc += insn->len;
+        }
+    }
+}
+
+static void mark_leader(u64 pc) {
+    i32 idx = ir_find(pc);
+    if (idx >= 0) insns[idx].leader = true;
+}
+
+/// @brief 连接顺序执行的后继，标记基本块的第一条指令
+static void ir_link(void) {
+    memset(npreds, 0, ninsns);
+    insns[0].leader = true;
+    for (u64 i = 0; i < ninsns; i++) {
+        ir_insn_t *e = &insns[i];
+        if (e->kind == ir_exit) continue;
+        enum insn_type_t type = e->insn.type;
+        u64 next_pc = e->pc + e->insn.len;
+        if (is_branch(type) || type == insn_jal) mark_leader(e->pc + (i64)e->insn.imm);
+        if (type == insn_jal || type == insn_jalr || type == insn_ecall) mark_leader(next_pc);
+        if (type == insn_jal || type == insn_jalr) continue;
+        e->next = ir_find(next_pc);
+        if (e->next >= 0 && npreds[e->next] < 2) npreds[e->next]++;
+    }
+    // 两条指令顺序执行到同一个 pc：如跳进一条 4 字节指令的中间
+    for (u64 i = 0; i < ninsns; i++)
+        if (npreds[i] > 1) insns[i].leader = true;
+}
+
+// ============================================================================== //
+// 指令的操作数
+// ============================================================================== //
+
+/// @brief 不分析操作数的指令：RV64IM 以外的指令，当作读写所有寄存器
+static bool is_opaque(ir_insn_t *e) {
+    return e->kind == ir_insn && e->insn.type > insn_ecall;
+}
+
+int ir_operands(ir_insn_t *e) {
+    switch (e->kind) {
+    case ir_li: return IR_DEF_RD;
+    case ir_mv: return IR_USE_RS1 | IR_DEF_RD;
+    case ir_nop:
+    case ir_exit: return 0;
+    case ir_insn: break;
+    }
+
+    enum insn_type_t type = e->insn.type;
+    if (type <= insn_lwu) return IR_USE_RS1 | IR_DEF_RD;
+    if (type == insn_fence || type == insn_fence_i) return 0;
+    if (type == insn_auipc || type == insn_lui || type == insn_jal || type == insn_ld_pc) return IR_DEF_RD;
+    if (type >= insn_addi && type <= insn_sraiw) return IR_USE_RS1 | IR_DEF_RD;
+    if (type >= insn_sb && type <= insn_sd) return IR_USE_RS1 | IR_USE_RS2;
+    if (is_branch(type)) return IR_USE_RS1 | IR_USE_RS2;
+    if (type == insn_jalr || type == insn_zext) return IR_USE_RS1 | IR_DEF_RD;
+    if (type >= insn_add && type <= insn_sraw) return IR_USE_RS1 | IR_USE_RS2 | IR_DEF_RD;
+    return 0;
+}
+
+/// @brief 没有副作用、只写 rd 的指令：结果不用时可以删除
+static bool is_pure(ir_insn_t *e) {
+    if (e->kind == ir_li || e->kind == ir_mv) return true;
+    if (e->kind != ir_insn || is_opaque(e)) return false;
+    enum insn_type_t type = e->insn.type;
+    return (type >= insn_addi && type <= insn_sraiw) ||
+           (type >= insn_add && type <= insn_sraw) || type == insn_zext;
+}
+
+static bool fits_i32(i64 val) {
+    return val == (i32)val;
+}
+
+// ============================================================================== //
+// 常量折叠：按 RISC-V 的规定计算，包括除数为 0 与溢出
+// ============================================================================== //
+
+static bool ir_eval(enum insn_type_t type, u64 a, u64 b, i64 imm, u64 pc, u64 *out) {
+    i32 a32 = (i32)a, b32 = (i32)b;
+    switch (type) {
+    case insn_addi:  *out = a + imm; break;
+    case insn_slli:  *out = a << (imm & 0x3f); break;
+    case insn_slti:  *out = (i64)a < imm; break;
+    case insn_sltiu: *out = a < (u64)imm; break;
+    case insn_xori:  *out = a ^ imm; break;
+    case insn_srli:  *out = a >> (imm & 0x3f); break;
+    case insn_srai:  *out = (i64)a >> (imm & 0x3f); break;
+    case insn_ori:   *out = a | imm; break;
+    case insn_andi:  *out = a & imm; break;
+    case insn_auipc: *out = pc + imm; break;
+    case insn_addiw: *out = (i64)(i32)(a + imm); break;
+    case insn_slliw: *out = (i64)(i32)((u32)a << (imm & 0x1f)); break;
+    case insn_srliw: *out = (i64)(i32)((u32)a >> (imm & 0x1f)); break;
+    case insn_sraiw: *out = (i64)(a32 >> (imm & 0x1f)); break;
+    case insn_add:   *out = a + b; break;
+    case insn_sll:   *out = a << (b & 0x3f); break;
+    case insn_slt:   *out = (i64)a < (i64)b; break;
+    case insn_sltu:  *out = a < b; break;
+    case insn_xor:   *out = a ^ b; break;
+    case insn_srl:   *out = a >> (b & 0x3f); break;
+    case insn_or:    *out = a | b; break;
+    case insn_and:   *out = a & b; break;
+    case insn_mul:   *out = a * b; break;
+    case insn_mulh:  *out = (u64)(((__int128)(i64)a * (__int128)(i64)b) >> 64); break;
+    case insn_mulhsu: *out = (u64)(((__int128)(i64)a * (__int128)b) >> 64); break;
+    case insn_mulhu: *out = (u64)(((unsigned __int128)a * b) >> 64); break;
+    case insn_div:
+        if (b == 0) *out = UINT64_MAX;
+        else if ((i64)a == INT64_MIN && (i64)b == -1) *out = a;
+        else *out = (i64)a / (i64)b;
+        break;
+    case insn_divu:  *out = b == 0 ? UINT64_MAX : a / b; break;
+    case insn_rem:
+        if (b == 0) *out = a;
+        else if ((i64)a == INT64_MIN && (i64)b == -1) *out = 0;
+        else *out = (i64)a % (i64)b;
+        break;
+    case insn_remu:  *out = b == 0 ? a : a % b; break;
+    case insn_sub:   *out = a - b; break;
+    case insn_sra:   *out = (i64)a >> (b & 0x3f); break;
+    case insn_lui:   *out = imm; break;
+    case insn_addw:  *out = (i64)(i32)(a + b); break;
+    case insn_sllw:  *out = (i64)(i32)((u32)a << (b & 0x1f)); break;
+    case insn_srlw:  *out = (i64)(i32)((u32)a >> (b & 0x1f)); break;
+    case insn_mulw:  *out = (i64)(i32)(a * b); break;
+    case insn_divw:
+        if (b32 == 0) *out = UINT64_MAX;
+        else if (a32 == INT32_MIN && b32 == -1) *out = (i64)a32;
+        else *out = (i64)(a32 / b32);
+        break;
+    case insn_divuw: *out = (u32)b == 0 ? UINT64_MAX : (u64)(i64)(i32)((u32)a / (u32)b); break;
+    case insn_remw:
+        if (b32 == 0) *out = (i64)a32;
+        else if (a32 == INT32_MIN && b32 == -1) *out = 0;
+        else *out = (i64)(a32 % b32);
+        break;
+    case insn_remuw: *out = (i64)(i32)((u32)b == 0 ? (u32)a : (u32)a % (u32)b); break;
+    case insn_subw:  *out = (i64)(i32)(a - b); break;
+    case insn_sraw:  *out = (i64)(a32 >> (b & 0x1f)); break;
+    case insn_zext:  *out = (a << (imm & 0x3f)) >> (imm & 0x3f); break;
+    case insn_beq:   *out = a == b; break;
+    case insn_bne:   *out = a != b; break;
+    case insn_blt:   *out = (i64)a < (i64)b; break;
+    case insn_bge:   *out = (i64)a >= (i64)b; break;
+    case insn_bltu:  *out = a < b; break;
+    case insn_bgeu:  *out = a >= b; break;
+    default: return false;
+    }
+    return true;
+}
+
+/// 基本块内已知的寄存器性质
+static struct {
+    bool known[num_gp_regs];    // 值为常量 val
+    u64 val[num_gp_regs];
+    bool sext[num_gp_regs];     // 值是低 32 位的符号扩展
+    u8 width[num_gp_regs];      // 高于 width 的位都是 0
+} facts;
+
+static void facts_reset(void) {
+    memset(&facts, 0, sizeof(facts));
+    memset(facts.width, 64, sizeof(facts.width));
+    facts.known[zero] = true;
+    facts.sext[zero] = true;
+    facts.width[zero] = 0;
+}
+
+static u8 bit_width(u64 val) {
+    return val == 0 ? 0 : 64 - __builtin_clzll(val);
+}
+
+static void fact_set(int r, bool known, u64 val, bool sext, u8 width) {
+    if (r == zero) return;
+    facts.known[r] = known;
+    facts.val[r] = val;
+    facts.sext[r] = sext || width < 32;
+    facts.width[r] = width;
+}
+
+static void fact_const(int r, u64 val) {
+    fact_set(r, true, val, val == (u64)(i64)(i32)val, bit_width(val));
+}
+
+static void to_li(ir_insn_t *e, u64 val) {
+    e->kind = ir_li;
+    e->val = val;
+    stats.folded++;
+}
+
+static void to_mv(ir_insn_t *e, int rs) {
+    e->kind = ir_mv;
+    e->insn.rs1 = rs;
+    stats.copies++;
+}
+
+static void to_imm(ir_insn_t *e, enum insn_type_t type, int rs, i64 imm) {
+    e->insn.type = type;
+    e->insn.rs1 = rs;
+    e->insn.rs2 = zero;
+    e->insn.imm = imm;
+    stats.folded++;
+}
+
+/// @brief 一个操作数是常量的寄存器运算改写成立即数形式
+static void fold_imm(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    bool ka = facts.known[insn->rs1], kb = facts.known[insn->rs2];
+    if (!ka && !kb) return;
+
+    // 可交换的运算：常量放到 rs2
+    switch (insn->type) {
+    case insn_add: case insn_and: case insn_or: case insn_xor: case insn_addw: case insn_mul:
+        if (ka) {
+            int t = insn->rs1;
+            insn->rs1 = insn->rs2;
+            insn->rs2 = t;
+            kb = true;
+            ka = false;
+        }
+        break;
+    default:
+        break;
+    }
+    if (!kb) return;
+
+    int rs = insn->rs1;
+    u64 c = facts.val[insn->rs2];
+    switch (insn->type) {
+    case insn_add:  if (fits_i32(c)) to_imm(e, insn_addi, rs, c); break;
+    case insn_sub:  if (fits_i32(-c)) to_imm(e, insn_addi, rs, -c); break;
+    case insn_and:  if (fits_i32(c)) to_imm(e, insn_andi, rs, c); break;
+    case insn_or:   if (fits_i32(c)) to_imm(e, insn_ori, rs, c); break;
+    case insn_xor:  if (fits_i32(c)) to_imm(e, insn_xori, rs, c); break;
+    case insn_slt:  if (fits_i32(c)) to_imm(e, insn_slti, rs, c); break;
+    case insn_sltu: if (fits_i32(c)) to_imm(e, insn_sltiu, rs, c); break;
+    case insn_sll:  to_imm(e, insn_slli, rs, c & 0x3f); break;
+    case insn_srl:  to_imm(e, insn_srli, rs, c & 0x3f); break;
+    case insn_sra:  to_imm(e, insn_srai, rs, c & 0x3f); break;
+    case insn_addw: to_imm(e, insn_addiw, rs, (i32)c); break;
+    case insn_subw: to_imm(e, insn_addiw, rs, (i32)-c); break;
+    case insn_sllw: to_imm(e, insn_slliw, rs, c & 0x1f); break;
+    case insn_srlw: to_imm(e, insn_srliw, rs, c & 0x1f); break;
+    case insn_sraw: to_imm(e, insn_sraiw, rs, c & 0x1f); break;
+    case insn_mul:
+        if (c == 0) to_li(e, 0);
+        else if (c == 1) to_mv(e, rs);
+        else if ((c & (c - 1)) == 0) to_imm(e, insn_slli, rs, __builtin_ctzll(c));
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * x0 与扩展的化简：结果等于某个源寄存器时改写成复制
+ *     addi/ori/xori 0，移位 0，andi -1      -> mv
+ *     andi 0                              -> li 0
+ *     addiw 0 且源已是符号扩展            -> mv
+ *     andi 2^k-1、zext 且源的高位已经是 0 -> mv
+ */
+static void simplify(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    int rs = insn->rs1;
+    i64 imm = insn->imm;
+    switch (insn->type) {
+    case insn_addi:
+    case insn_ori:
+    case insn_xori:
+        if (imm == 0) to_mv(e, rs);
+        break;
+    case insn_slli:
+    case insn_srli:
+    case insn_srai:
+        if ((imm & 0x3f) == 0) to_mv(e, rs);
+        break;
+    case insn_andi:
+        if (imm == -1) to_mv(e, rs);
+        else if (imm == 0) to_li(e, 0);
+        else if (imm > 0 && (imm & (imm + 1)) == 0 && facts.width[rs] <= bit_width(imm)) to_mv(e, rs);
+        break;
+    case insn_zext:
+        if (facts.width[rs] <= 64 - (imm & 0x3f)) to_mv(e, rs);
+        break;
+    case insn_addiw:
+    case insn_slliw:
+    case insn_srliw:
+    case insn_sraiw:
+        if ((insn->type == insn_addiw ? imm : imm & 0x1f) == 0 && facts.sext[rs]) to_mv(e, rs);
+        break;
+    default:
+        break;
+    }
+    // 从 x0 复制就是常量 0，复制到自身什么也不做
+    if (e->kind == ir_mv && e->insn.rs1 == zero) to_li(e, 0);
+    if (e->kind == ir_mv && e->insn.rs1 == e->insn.rd) e->kind = ir_nop;
+}
+
+/// @brief 指令执行后 rd 的性质
+static void fold_def(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    int rd = insn->rd;
+    if (e->kind == ir_li) {
+        fact_const(rd, e->val);
+        return;
+    }
+    if (e->kind == ir_mv) {
+        int rs = insn->rs1;
+        fact_set(rd, facts.known[rs], facts.val[rs], facts.sext[rs], facts.width[rs]);
+        return;
+    }
+
+    switch (insn->type) {
+    case insn_lb: case insn_lh: case insn_lw:
+        fact_set(rd, false, 0, true, 64);
+        break;
+    case insn_lbu: fact_set(rd, false, 0, true, 8); break;
+    case insn_lhu: fact_set(rd, false, 0, true, 16); break;
+    case insn_lwu: fact_set(rd, false, 0, false, 32); break;
+    case insn_slti: case insn_sltiu: case insn_slt: case insn_sltu:
+        fact_set(rd, false, 0, true, 1);
+        break;
+    case insn_andi:
+        fact_set(rd, false, 0, false, insn->imm < 0 ? facts.width[insn->rs1] : bit_width(insn->imm));
+        break;
+    case insn_srli:
+    case insn_zext:
+        fact_set(rd, false, 0, false, (insn->imm & 0x3f) ? 64 - (insn->imm & 0x3f) : facts.width[insn->rs1]);
+        break;
+    case insn_addiw: case insn_slliw: case insn_srliw: case insn_sraiw:
+    case insn_addw: case insn_sllw: case insn_srlw: case insn_mulw: case insn_divw:
+    case insn_divuw: case insn_remw: case insn_remuw: case insn_subw: case insn_sraw:
+        fact_set(rd, false, 0, true, 64);
+        break;
+    case insn_jal:
+    case insn_jalr:
+        fact_const(rd, e->pc + insn->len);
+        break;
+    default:
+        fact_set(rd, false, 0, false, 64);
+        break;
+    }
+}
+
+static void ir_fold(void) {
+    facts_reset();
+    for (u64 i = 0; i < nblock; i++) {
+        ir_insn_t *e = &insns[block[i]];
+        if (e->kind == ir_nop || e->kind == ir_exit) continue;
+        if (is_opaque(e)) {
+            facts_reset();
+            continue;
+        }
+
+        insn_t *insn = &e->insn;
+        if (e->kind == ir_insn && insn->type == insn_ecall) {
+            // 系统调用编号：C 后端据此选择快速路径
+            e->known = facts.known[a7];
+            e->val = facts.val[a7];
+            fact_set(a0, false, 0, false, 64);
+            continue;
+        }
+
+        int ops = ir_operands(e);
+        if (e->kind == ir_insn && is_pure(e) && insn->rd == zero) {
+            e->kind = ir_nop;
+            stats.dead++;
+            continue;
+        }
+
+        if (e->kind == ir_insn) {
+            bool ka = !(ops & IR_USE_RS1) || facts.known[insn->rs1];
+            bool kb = !(ops & IR_USE_RS2) || facts.known[insn->rs2];
+            u64 out;
+            if (ka && kb && (is_pure(e) || is_branch(insn->type)) &&
+                ir_eval(insn->type, facts.val[insn->rs1], facts.val[insn->rs2], insn->imm, e->pc, &out)) {
+                if (!is_branch(insn->type)) {
+                    to_li(e, out);
+                } else if (out) {
+                    // 一定跳转：与 jal x0 相同
+                    insn->type = insn_jal;
+                    insn->rd = zero;
+                    insn->cont = true;
+                    e->next = -1;
+                    stats.folded++;
+                } else {
+                    e->kind = ir_nop;
+                    stats.folded++;
+                }
+            } else if (is_pure(e)) {
+                fold_imm(e);
+                if (e->kind == ir_insn) simplify(e);
+            }
+        } else if (e->kind == ir_mv) {
+            simplify(e);
+        }
+
+        if (ir_operands(e) & IR_DEF_RD) fold_def(e);
+    }
+}
+
+// ============================================================================== //
+// 复制传播：rd = rs 之后读 rd 改为读 rs，只要 rs 还是同一个 SSA 值
+// ============================================================================== //
+
+static struct {
+    u32 ver[num_gp_regs];       // 寄存器当前的版本
+    i8 src[num_gp_regs];        // 复制的来源：-1 表示不是复制
+    u32 src_ver[num_gp_regs];   // 复制时来源的版本
+} copies;
+
+static void copies_reset(void) {
+    memset(copies.src, -1, sizeof(copies.src));
+}
+
+static int copy_of(int r) {
+    int s = copies.src[r];
+    return s >= 0 && copies.ver[s] == copies.src_ver[r] ? s : r;
+}
+
+static void copy_def(int rd) {
+    copies.ver[rd]++;
+    copies.src[rd] = -1;
+}
+
+static void ir_copy(void) {
+    copies_reset();
+    for (u64 i = 0; i < nblock; i++) {
+        ir_insn_t *e = &insns[block[i]];
+        insn_t *insn = &e->insn;
+        if (is_opaque(e)) {
+            copies_reset();
+            continue;
+        }
+        if (e->kind == ir_insn && insn->type == insn_ecall) {
+            copy_def(a0);
+            continue;
+        }
+
+        int ops = ir_operands(e);
+        if (ops & IR_USE_RS1) insn->rs1 = copy_of(insn->rs1);
+        if (ops & IR_USE_RS2) insn->rs2 = copy_of(insn->rs2);
+        if (e->kind == ir_mv && insn->rs1 == insn->rd) {
+            e->kind = ir_nop;
+            continue;
+        }
+
+        if ((ops & IR_DEF_RD) && insn->rd != zero) {
+            copy_def(insn->rd);
+            if (e->kind == ir_mv) {
+                copies.src[insn->rd] = insn->rs1;
+                copies.src_ver[insn->rd] = copies.ver[insn->rs1];
+            }
+        }
+    }
+}
+
+// ============================================================================== //
+// 死代码删除：从基本块出口往回，删除结果在被读之前就被覆盖的指令
+// ============================================================================== //
+
+static void ir_dce(void) {
+    bool live[num_gp_regs];
+    memset(live, true, sizeof(live));
+    for (i64 i = nblock - 1; i >= 0; i--) {
+        ir_insn_t *e = &insns[block[i]];
+        insn_t *insn = &e->insn;
+        if (e->kind == ir_exit || is_opaque(e)) {
+            memset(live, true, sizeof(live));
+            continue;
+        }
+        // 基本块越过条件跳转继续：跳转目标可能读任何寄存器
+        if (e->kind == ir_insn && is_branch(insn->type)) memset(live, true, sizeof(live));
+        if (e->kind == ir_insn && insn->type == insn_ecall) {
+            // syscall 只读 a0-a7
+            for (int r = a0; r <= a7; r++) live[r] = true;
+            continue;
+        }
+
+        int ops = ir_operands(e);
+        if (is_pure(e) && !live[insn->rd]) {
+            e->kind = ir_nop;
+            stats.dead++;
+            continue;
+        }
+        if (ops & IR_DEF_RD) live[insn->rd] = false;
+        if (ops & IR_USE_RS1) live[insn->rs1] = true;
+        if (ops & IR_USE_RS2) live[insn->rs2] = true;
+    }
+}
+
+// ============================================================================== //
+// 栈槽提升：sp 或 s0 加固定偏移的读写放在主机局部变量中。
+// 写栈槽同时写内存，所以跳出代码块时不用写回，其他读内存的指令也总能读到新值；
+// 可能改写栈槽的指令之后，栈槽对应的局部变量失效或重新读取：
+//     基址寄存器被改写、ecall、浮点写内存      -> 全部失效
+//     其他基址的写内存                         -> 后端在运行时检查地址，落在栈槽上时重新读取
+// 入口处已经有效的栈槽由后端先读取：只读取之后一定会访问的栈槽，不会多出访问非法地址。
+// ============================================================================== //
+
+static bool is_load(enum insn_type_t type) {
+    return type <= insn_lwu;
+}
+
+static bool is_store(enum insn_type_t type) {
+    return type >= insn_sb && type <= insn_sd;
+}
+
+static u8 access_size(enum insn_type_t type) {
+    switch (type) {
+    case insn_lb: case insn_lbu: case insn_sb: return 1;
+    case insn_lh: case insn_lhu: case insn_sh: return 2;
+    case insn_lw: case insn_lwu: case insn_sw: return 4;
+    default: return 8;
+    }
+}
+
+/// @brief 栈帧中的访问：sp 向上，s0 向下
+static bool is_frame_access(ir_insn_t *e, int base) {
+    if (e->kind != ir_insn || e->insn.rs1 != base) return false;
+    if (!is_load(e->insn.type) && !is_store(e->insn.type)) return false;
+    return base == sp ? e->insn.imm >= 0 : e->insn.imm < 0;
+}
+
+static i32 slot_find(int base, i32 off, u8 size) {
+    for (u64 k = 0; k < nslots; k++)
+        if (slots[k].base == base && slots[k].off == off && slots[k].size == size) return k;
+    return -1;
+}
+
+/// @brief 选出基址寄存器与栈槽：偏移与宽度都相同的访问是同一个栈槽，部分重叠的栈槽不提升
+static void slots_collect(void) {
+    u64 count[2] = {0, 0};
+    for (u64 i = 0; i < ninsns; i++) {
+        count[0] += is_frame_access(&insns[i], sp);
+        count[1] += is_frame_access(&insns[i], s0);
+    }
+    int base = count[1] >= count[0] ? s0 : sp;
+
+    nslots = 0;
+    bool overlap[IR_MAX_SLOTS] = {false};
+    for (u64 i = 0; i < ninsns; i++) {
+        ir_insn_t *e = &insns[i];
+        e->slot = -1;
+        if (!is_frame_access(e, base)) continue;
+        i32 off = e->insn.imm;
+        u8 size = access_size(e->insn.type);
+        i32 k = slot_find(base, off, size);
+        if (k < 0) {
+            if (nslots == IR_MAX_SLOTS) continue;
+            k = nslots++;
+            slots[k] = (ir_slot_t){ .base = base, .off = off, .size = size };
+            for (i32 j = 0; j < k; j++)
+                if (off < slots[j].off + slots[j].size && slots[j].off < off + size)
+                    overlap[j] = overlap[k] = true;
+        }
+        e->slot = k;
+    }
+    for (u64 i = 0; i < ninsns; i++)
+        if (insns[i].slot >= 0 && overlap[insns[i].slot]) insns[i].slot = -1;
+}
+
+/// @brief 可能改写栈槽的指令：基址寄存器被改写、ecall、浮点写内存
+static bool slots_kill(ir_insn_t *e) {
+    insn_t *insn = &e->insn;
+    int base = slots[0].base;
+    if (e->kind == ir_li || e->kind == ir_mv) return insn->rd == base;
+    if (e->kind != ir_insn) return false;
+    if (insn->type == insn_ecall || insn->type == insn_fsw || insn->type == insn_fsd) return true;
+    if (is_opaque(e)) return insn->rd == base;
+    return (ir_operands(e) & IR_DEF_RD) && insn->rd == base;
+}
+
+/// @brief 跳转目标的下标：不是直接跳转或不在代码块中时为 -1
+static i32 jump_target(ir_insn_t *e) {
+    if (e->kind != ir_insn || !(is_branch(e->insn.type) || e->insn.type == insn_jal)) return -1;
+    return ir_find(e->pc + (i64)e->insn.imm);
+}
+
+/**
+ * 两遍数据流分析，集合都只会变小，反复传播到不动点：
+ *     anticipated：从这条指令开始的每条路径都会在失效之前读写的栈槽，入口处先读取它们不会多访问内存
+ *     avail：执行前有效的栈槽，即所有前驱之后都有效；基本块开头都可能是入口，只保留 anticipated 的栈槽
+ */
+static void ir_promote(void) {
+    slots_collect();
+    if (nslots == 0) return;
+
+    u64 all = nslots == IR_MAX_SLOTS ? ~0ULL : (1ULL << nslots) - 1;
+    for (u64 i = 0; i < ninsns; i++) {
+        anticipated[i] = all;
+        avail_out[i] = all;
+    }
+
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (i64 i = ninsns - 1; i >= 0; i--) {
+            ir_insn_t *e = &insns[i];
+            i32 t = jump_target(e);
+            u64 out = e->next < 0 && t < 0 ? 0 : all;
+            if (e->next >= 0) out &= anticipated[e->next];
+            if (t >= 0) out &= anticipated[t];
+            u64 in = slots_kill(e) ? 0 : out;
+            if (e->slot >= 0) in |= 1ULL << e->slot;
+            if (in == anticipated[i]) continue;
+            anticipated[i] = in;
+            changed = true;
+        }
+    }
+
+    for (u64 i = 0; i < ninsns; i++)
+        insns[i].avail = insns[i].leader ? anticipated[i] : all;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (u64 i = 0; i < ninsns; i++) {
+            ir_insn_t *e = &insns[i];
+            u64 out = slots_kill(e) ? 0 : e->avail;
+            if (e->slot >= 0 && !slots_kill(e)) out |= 1ULL << e->slot;
+            if (out == avail_out[i]) continue;
+            avail_out[i] = out;
+            changed = true;
+            if (e->next >= 0) insns[e->next].avail &= out;
+            i32 t = jump_target(e);
+            if (t >= 0) insns[t].avail &= out;
+        }
+    }
+
+    if (TEMU_STATS)
+        for (u64 i = 0; i < ninsns; i++)
+            if (insns[i].slot >= 0 && is_load(insns[i].insn.type) && (insns[i].avail >> insns[i].slot & 1))
+                stats.promoted++;
+}
+
+ir_slot_t *ir_slots(u64 *n) {
+    *n = nslots;
+    return slots;
+}
+
+void ir_slots_range(u64 mask, i64 *lo, i64 *hi) {
+    *lo = INT64_MAX;
+    *hi = INT64_MIN;
+    for (u64 m = mask; m; m &= m - 1) {
+        ir_slot_t *slot = &slots[__builtin_ctzll(m)];
+        *lo = MIN(*lo, (i64)slot->off);
+        *hi = MAX(*hi, (i64)slot->off + slot->size);
+    }
+}
+
+// ============================================================================== //
+// 冷热
+// ============================================================================== //
+
+/// @brief 从 idx 开始的基本块是冷的：顺序执行到下一个基本块为止
+static void mark_cold(i32 idx) {
+    for (i32 j = idx; j >= 0 && (j == idx || !insns[j].leader); j = insns[j].next)
+        insns[j].cold = true;
+}
+
+/**
+ * 按解释执行时的次数标记冷的指令：解释器在每个跳转之后回到 machine_step，
+ * 两个后继各自进入了多少次就是这个跳转两边的次数
+ *     跳出到解释器与退出程序的出口总是冷的
+ */
+static void ir_profile(cache_t *cache) {
+    for (u64 i = 0; i < ninsns; i++) insns[i].cold = false;
+    if (!CACHE_SPLIT) return;
+    for (u64 i = 0; i < ninsns; i++) {
+        ir_insn_t *e = &insns[i];
+        if (e->kind == ir_exit && e->reason != direct_branch) e->cold = true;
+        if (e->kind != ir_insn || !is_branch(e->insn.type) || e->next < 0) continue;
+        u64 target = e->pc + (i64)e->insn.imm;
+        u64 taken = cache_count(cache, target);
+        u64 fall = cache_count(cache, insns[e->next].pc);
+        if (taken * IR_COLD_RATIO < fall) mark_cold(ir_find(target));
+        else if (fall * IR_COLD_RATIO < taken) mark_cold(e->next);
+    }
+}
+
+bool ir_cold(u64 pc) {
+    i32 idx = ir_find(pc);
+    return idx >= 0 && insns[idx].cold;
+}
+
+// ============================================================================== //
+// 代码块
+// ============================================================================== //
+
+static void ir_optimize(void) {
+    for (u64 i = 0; i < ninsns; i++) {
+        if (!insns[i].leader) continue;
+        nblock = 0;
+        for (i32 j = i; j >= 0 && (nblock == 0 || !insns[j].leader); j = insns[j].next)
+            block[nblock++] = j;
+        ir_fold();
+        ir_copy();
+        ir_dce();
+    }
+}
+
+ir_insn_t *ir_build(u64 start, u64 max, bool trace, cache_t *cache, u64 *n) {
+    assert(max <= IR_MAX_INSNS);
+    map_gen++;
+    ninsns = 0;
+    ir_discover(start, max, trace);
+    ir_link();
+    ir_profile(cache);
+    if (IR_OPTIMIZE) ir_optimize();
+    nslots = 0;
+    for (u64 i = 0; i < ninsns; i++) {
+        insns[i].slot = -1;
+        insns[i].avail = 0;
+    }
+    if (IR_PROMOTE_SLOTS) ir_promote();
+
+    if (TEMU_STATS) {
+        stats.regions++;
+        stats.insns += ninsns;
+    }
+    *n = ninsns;
+    return insns;
+}
+
+void ir_report(void) {
+    if (stats.regions == 0) return;
+    fprintf(stderr, "ir: %lu regions, %lu insns, %lu folded, %lu copies, %lu dead, %lu promoted\n",
+            stats.regions, stats.insns, stats.folded, stats.copies, stats.dead, stats.promoted);
+}
@@ -0,0 +1,505 @@
+/**
+ * \file src/llvm.c
+ * \brief LLVM 编译器：在进程内把 RV64IM 代码块翻译成 LLVM IR 并编译
+ */
+
+#include "temu.h"
+
+#if COMPILE_LLVM
+
+#include <llvm-c/Core.h>
+#include <llvm-c/Target.h>
+#include <llvm-c/TargetMachine.h>
+#include <llvm-c/Transforms/PassBuilder.h>
+
+/// 代码块最多的指令数：超过时交给 clang
+#define LLVM_MAX_INSNS 4096
+
+static ir_insn_t *insns;                        // 代码块的 IR：由 ir_build 给出
+static u64 ninsns;
+static LLVMBasicBlockRef bbs[LLVM_MAX_INSNS];   // 每条指令的基本块
+
+static LLVMContextRef ctx;
+static LLVMTargetMachineRef tm;
+static LLVMTypeRef t_void, t_i1, t_i8, t_i16, t_i32, t_i64, t_i128, t_syscall;
+
+/// 当前代码块的生成状态
+static LLVMBuilderRef bld;
+static LLVMValueRef state;                  // state_t *：按 i8 * 寻址
+static LLVMValueRef regs[num_gp_regs];      // guest 寄存器的 alloca：优化后提升为 SSA
+static ir_slot_t *slots;                    // 栈槽：由 ir_slots 给出
+static LLVMValueRef slot_vars[IR_MAX_SLOTS];    // 栈槽的 alloca：保存原始位
+static LLVMBasicBlockRef end_bb;
+
+static struct {
+    u64 regions;
+    u64 fallbacks;
+    u64 ns;
+} stats;
+
+/// @brief 取得代码块的 IR
+/// @return 是否都能翻译：只支持 RV64IM，放不下的代码块交给 clang
+static bool llvm_discover(u64 start, cache_t *cache) {
+    insns = ir_build(start, LLVM_MAX_INSNS, true, cache, &ninsns);
+    for (u64 i = 0; i < ninsns; i++) {
+        ir_insn_t *e = &insns[i];
+        if (e->kind == ir_insn && e->insn.type > insn_ecall) return false;
+        if (e->kind == ir_exit && e->reason == direct_branch) return false;
+    }
+    return true;
+}
+
+// ============================================================================== //
+// IR 构造
+// ============================================================================== //
+
+static LLVMValueRef c64(u64 val) {
+    return LLVMConstInt(t_i64, val, false);
+}
+
+static LLVMValueRef c32(u32 val) {
+    return LLVMConstInt(t_i32, val, false);
+}
+
+/// @brief state 中 offset 处类型为 type 的字段地址
+static LLVMValueRef state_field(i32 offset, LLVMTypeRef type) {
+    LLVMValueRef off = c64(offset);
+    LLVMValueRef p = LLVMBuildGEP2(bld, t_i8, state, &off, 1, "");
+    return LLVMBuildBitCast(bld, p, LLVMPointerType(type, 0), "");
+}
+
+static LLVMValueRef get_reg(int r) {
+    if (r == zero) return c64(0);
+    return LLVMBuildLoad2(bld, t_i64, regs[r], "");
+}
+
+static void set_reg(int r, LLVMValueRef val) {
+    if (r != zero) LLVMBuildStore(bld, val, regs[r]);
+}
+
+/// @brief guest 地址 addr 对应的主机指针
+static LLVMValueRef guest_ptr(LLVMValueRef addr, LLVMTypeRef type) {
+    LLVMValueRef host = LLVMBuildAdd(bld, addr, c64(GUEST_MEMORY_OFFSET), "");
+    return LLVMBuildIntToPtr(bld, host, LLVMPointerType(type, 0), "");
+}
+
+static LLVMValueRef sext32(LLVMValueRef val) {
+    return LLVMBuildSExt(bld, LLVMBuildTrunc(bld, val, t_i32, ""), t_i64, "");
+}
+
+/// @brief 跳出代码块
+static void exit_block(enum exit_reason_t reason, LLVMValueRef pc) {
+    LLVMBuildStore(bld, c32(reason), state_field(offsetof(state_t, exit_reason), t_i32));
+    LLVMBuildStore(bld, pc, state_field(offsetof(state_t, reenter_pc), t_i64));
+    LLVMBuildBr(bld, end_bb);
+}
+
+static LLVMBasicBlockRef bb_of(u64 pc) {
+    i32 idx = ir_find(pc);
+    assert(idx >= 0);
+    return bbs[idx];
+}
+
+/**
+ * 除法：按 RISC-V 的规定处理除数为 0 与溢出，且不让 LLVM 看到未定义行为
+ *     div:  rs2 == 0 -> -1，    rs2 == -1 -> -rs1
+ *     rem:  rs2 == 0 -> rs1，   rs2 == -1 -> 0
+ */
+static LLVMValueRef build_div(LLVMValueRef a, LLVMValueRef b, LLVMTypeRef t, bool sign, bool rem) {
+    LLVMValueRef zero_v = LLVMConstInt(t, 0, false);
+    LLVMValueRef one = LLVMConstInt(t, 1, false);
+    LLVMValueRef neg1 = LLVMConstAllOnes(t);
+    LLVMValueRef is_zero = LLVMBuildICmp(bld, LLVMIntEQ, b, zero_v, "");
+    LLVMValueRef is_neg1 = LLVMBuildICmp(bld, LLVMIntEQ, b, neg1, "");
+    LLVMValueRef bad = sign ? LLVMBuildOr(bld, is_zero, is_neg1, "") : is_zero;
+    LLVMValueRef d = LLVMBuildSelect(bld, bad, one, b, "");
+
+    LLVMValueRef q;
+    if (sign) q = rem ? LLVMBuildSRem(bld, a, d, "") : LLVMBuildSDiv(bld, a, d, "");
+    else q = rem ? LLVMBuildURem(bld, a, d, "") : LLVMBuildUDiv(bld, a, d, "");
+    if (sign) q = LLVMBuildSelect(bld, is_neg1, rem ? zero_v : LLVMBuildNeg(bld, a, ""), q, "");
+    return LLVMBuildSelect(bld, is_zero, rem ? a : neg1, q, "");
+}
+
+static LLVMValueRef build_mulh(LLVMValueRef a, LLVMValueRef b, bool sign_a, bool sign_b) {
+    a = sign_a ? LLVMBuildSExt(bld, a, t_i128, "") : LLVMBuildZExt(bld, a, t_i128, "");
+    b = sign_b ? LLVMBuildSExt(bld, b, t_i128, "") : LLVMBuildZExt(bld, b, t_i128, "");
+    LLVMValueRef p = LLVMBuildMul(bld, a, b, "");
+    p = LLVMBuildLShr(bld, p, LLVMConstInt(t_i128, 64, false), "");
+    return LLVMBuildTrunc(bld, p, t_i64, "");
+}
+
+static LLVMValueRef build_shift(LLVMOpcode op, LLVMValueRef a, LLVMValueRef sh, bool w) {
+    if (!w) {
+        a = LLVMBuildTrunc(bld, a, t_i32, "");
+        sh = LLVMBuildAnd(bld, LLVMBuildTrunc(bld, sh, t_i32, ""), c32(31), "");
+        return LLVMBuildSExt(bld, LLVMBuildBinOp(bld, op, a, sh, ""), t_i64, "");
+    }
+    return LLVMBuildBinOp(bld, op, a, LLVMBuildAnd(bld, sh, c64(63), ""), "");
+}
+
+static LLVMValueRef build_cmp(LLVMIntPredicate pred, LLVMValueRef a, LLVMValueRef b) {
+    return LLVMBuildZExt(bld, LLVMBuildICmp(bld, pred, a, b, ""), t_i64, "");
+}
+
+static LLVMTypeRef slot_type(ir_slot_t *slot) {
+    switch (slot->size) {
+    case 1: return t_i8;
+    case 2: return t_i16;
+    case 4: return t_i32;
+    default: return t_i64;
+    }
+}
+
+static void slot_set(int k, LLVMValueRef val) {
+    if (LLVMTypeOf(val) != t_i64) val = LLVMBuildZExt(bld, val, t_i64, "");
+    LLVMBuildStore(bld, val, slot_vars[k]);
+}
+
+/// @brief 从内存重新读取 mask 中的栈槽
+static void slot_reload(u64 mask) {
+    for (u64 m = mask; m; m &= m - 1) {
+        int k = __builtin_ctzll(m);
+        LLVMTypeRef t = slot_type(&slots[k]);
+        LLVMValueRef addr = LLVMBuildAdd(bld, get_reg(slots[k].base), c64((i64)slots[k].off), "");
+        LLVMValueRef val = LLVMBuildLoad2(bld, t, guest_ptr(addr, t), "");
+        LLVMSetAlignment(val, 1);
+        slot_set(k, val);
+    }
+}
+
+/// @brief 新建基本块：cond 成立时先执行 then 开头的代码，之后都接着执行返回的基本块
+static LLVMBasicBlockRef build_if(LLVMValueRef cond, LLVMBasicBlockRef *then) {
+    LLVMValueRef func = LLVMGetBasicBlockParent(LLVMGetInsertBlock(bld));
+    *then = LLVMAppendBasicBlockInContext(ctx, func, "");
+    LLVMBasicBlockRef done = LLVMAppendBasicBlockInContext(ctx, func, "");
+    LLVMBuildCondBr(bld, cond, *then, done);
+    return done;
+}
+
+/// @brief 条件跳转恰有一边是冷的时候加上 branch_weights，让 LLVM 把冷的一边放到函数末尾
+static void set_weights(LLVMValueRef br, u64 taken, u64 next) {
+    bool cold_taken = ir_cold(taken), cold_next = ir_cold(next);
+    if (cold_taken == cold_next) return;
+    LLVMMetadataRef ops[] = {
+        LLVMMDStringInContext2(ctx, "branch_weights", 14),
+        LLVMValueAsMetadata(c32(cold_taken ? 1 : IR_COLD_RATIO)),
+        LLVMValueAsMetadata(c32(cold_next ? 1 : IR_COLD_RATIO)),
+    };
+    LLVMValueRef md = LLVMMetadataAsValue(ctx, LLVMMDNodeInContext2(ctx, ops, 3));
+    LLVMSetMetadata(br, LLVMGetMDKindIDInContext(ctx, "prof", 4), md);
+}
+
+/// @brief 读内存：读有效的栈槽时不访问内存
+static void build_load(ir_insn_t *e, LLVMTypeRef t, bool sign) {
+    insn_t *insn = &e->insn;
+    LLVMValueRef val;
+    if (e->slot >= 0 && (e->avail >> e->slot & 1)) {
+        val = LLVMBuildLoad2(bld, t_i64, slot_vars[e->slot], "");
+        if (t != t_i64) val = LLVMBuildTrunc(bld, val, t, "");
+    } else {
+        LLVMValueRef addr = LLVMBuildAdd(bld, get_reg(insn->rs1), c64((i64)insn->imm), "");
+        val = LLVMBuildLoad2(bld, t, guest_ptr(addr, t), "");
+        LLVMSetAlignment(val, 1);
+        if (e->slot >= 0) slot_set(e->slot, val);
+    }
+    if (t != t_i64) val = sign ? LLVMBuildSExt(bld, val, t_i64, "") : LLVMBuildZExt(bld, val, t_i64, "");
+    set_reg(insn->rd, val);
+}
+
+/// @brief 写内存：同时写栈槽，其他基址的写落在有效的栈槽附近时重新读取这些栈槽
+static void build_store(ir_insn_t *e, LLVMTypeRef t) {
+    insn_t *insn = &e->insn;
+    LLVMValueRef addr = LLVMBuildAdd(bld, get_reg(insn->rs1), c64((i64)insn->imm), "");
+    LLVMValueRef val = get_reg(insn->rs2);
+    if (t != t_i64) val = LLVMBuildTrunc(bld, val, t, "");
+    LLVMSetAlignment(LLVMBuildStore(bld, val, guest_ptr(addr, t)), 1);
+
+    if (e->slot >= 0) {
+        slot_set(e->slot, val);
+    } else if (e->avail != 0) {
+        i64 lo, hi;
+        ir_slots_range(e->avail, &lo, &hi);
+        LLVMValueRef from = LLVMBuildAdd(bld, get_reg(slots[0].base), c64(lo - 7), "");
+        LLVMValueRef cond = LLVMBuildICmp(bld, LLVMIntULT, LLVMBuildSub(bld, addr, from, ""), c64(hi - lo + 7), "");
+        LLVMBasicBlockRef reload;
+        LLVMBasicBlockRef done = build_if(cond, &reload);
+        LLVMPositionBuilderAtEnd(bld, reload);
+        slot_reload(e->avail);
+        LLVMBuildBr(bld, done);
+        LLVMPositionBuilderAtEnd(bld, done);
+    }
+}
+
+static void build_ecall(void) {
+    // syscall 从 state 读取 a0-a7
+    for (int r = a0; r <= a7; r++)
+        LLVMBuildStore(bld, get_reg(r), state_field(offsetof(state_t, gp_regs) + 8 * r, t_i64));
+    LLVMTypeRef fp = LLVMPointerType(t_syscall, 0);
+    LLVMValueRef fn = LLVMBuildLoad2(bld, fp, state_field(offsetof(state_t, syscall), fp), "");
+    LLVMValueRef arg = state;
+    set_reg(a0, LLVMBuildCall2(bld, t_syscall, fn, &arg, 1, ""));
+}
+
+/// @brief 翻译一条指令：结尾总是跳转到后继基本块
+static void build_insn(u64 idx) {
+    ir_insn_t *e = &insns[idx];
+    insn_t *insn = &e->insn;
+    u64 next_pc = e->pc + insn->len;
+    LLVMPositionBuilderAtEnd(bld, bbs[idx]);
+
+    switch (e->kind) {
+    case ir_exit:
+        exit_block(e->reason, c64(e->val));
+        return;
+    case ir_li:
+        set_reg(insn->rd, c64(e->val));
+        LLVMBuildBr(bld, bb_of(next_pc));
+        return;
+    case ir_mv:
+        set_reg(insn->rd, get_reg(insn->rs1));
+        LLVMBuildBr(bld, bb_of(next_pc));
+        return;
+    case ir_nop:
+        LLVMBuildBr(bld, bb_of(next_pc));
+        return;
+    case ir_insn:
+        break;
+    }
+
+    LLVMValueRef rs1 = get_reg(insn->rs1);
+    LLVMValueRef rs2 = get_reg(insn->rs2);
+    LLVMValueRef imm = c64((i64)insn->imm);
+    LLVMValueRef rs1w = LLVMBuildTrunc(bld, rs1, t_i32, "");
+    LLVMValueRef rs2w = LLVMBuildTrunc(bld, rs2, t_i32, "");
+    LLVMValueRef rd = NULL;
+
+    switch (insn->type) {
+    case insn_lb:  build_load(e, t_i8, true); break;
+    case insn_lh:  build_load(e, t_i16, true); break;
+    case insn_lw:  build_load(e, t_i32, true); break;
+    case insn_ld:  build_load(e, t_i64, true); break;
+    case insn_lbu: build_load(e, t_i8, false); break;
+    case insn_lhu: build_load(e, t_i16, false); break;
+    case insn_lwu: build_load(e, t_i32, false); break;
+    case insn_fence:
+    case insn_fence_i: break;
+    case insn_addi:  rd = LLVMBuildAdd(bld, rs1, imm, ""); break;
+    case insn_slli:  rd = LLVMBuildShl(bld, rs1, c64(insn->imm & 0x3f), ""); break;
+    case insn_slti:  rd = build_cmp(LLVMIntSLT, rs1, imm); break;
+    case insn_sltiu: rd = build_cmp(LLVMIntULT, rs1, imm); break;
+    case insn_xori:  rd = LLVMBuildXor(bld, rs1, imm, ""); break;
+    case insn_srli:  rd = LLVMBuildLShr(bld, rs1, c64(insn->imm & 0x3f), ""); break;
+    case insn_srai:  rd = LLVMBuildAShr(bld, rs1, c64(insn->imm & 0x3f), ""); break;
+    case insn_ori:   rd = LLVMBuildOr(bld, rs1, imm, ""); break;
+    case insn_andi:  rd = LLVMBuildAnd(bld, rs1, imm, ""); break;
+    case insn_auipc: rd = c64(e->pc + (i64)insn->imm); break;
+    case insn_addiw: rd = sext32(LLVMBuildAdd(bld, rs1, imm, "")); break;
+    case insn_slliw: rd = build_shift(LLVMShl, rs1, c64(insn->imm), false); break;
+    case insn_srliw: rd = build_shift(LLVMLShr, rs1, c64(insn->imm), false); break;
+    case insn_sraiw: rd = build_shift(LLVMAShr, rs1, c64(insn->imm), false); break;
+    case insn_sb: build_store(e, t_i8); break;
+    case insn_sh: build_store(e, t_i16); break;
+    case insn_sw: build_store(e, t_i32); break;
+    case insn_sd: build_store(e, t_i64); break;
+    case insn_add:    rd = LLVMBuildAdd(bld, rs1, rs2, ""); break;
+    case insn_sll:    rd = build_shift(LLVMShl, rs1, rs2, true); break;
+    case insn_slt:    rd = build_cmp(LLVMIntSLT, rs1, rs2); break;
+    case insn_sltu:   rd = build_cmp(LLVMIntULT, rs1, rs2); break;
+    case insn_xor:    rd = LLVMBuildXor(bld, rs1, rs2, ""); break;
+    case insn_srl:    rd = build_shift(LLVMLShr, rs1, rs2, true); break;
+    case insn_or:     rd = LLVMBuildOr(bld, rs1, rs2, ""); break;
+    case insn_and:    rd = LLVMBuildAnd(bld, rs1, rs2, ""); break;
+    case insn_mul:    rd = LLVMBuildMul(bld, rs1, rs2, ""); break;
+    case insn_mulh:   rd = build_mulh(rs1, rs2, true, true); break;
+    case insn_mulhsu: rd = build_mulh(rs1, rs2, true, false); break;
+    case insn_mulhu:  rd = build_mulh(rs1, rs2, false, false); break;
+    case insn_div:    rd = build_div(rs1, rs2, t_i64, true, false); break;
+    case insn_divu:   rd = build_div(rs1, rs2, t_i64, false, false); break;
+    case insn_rem:    rd = build_div(rs1, rs2, t_i64, true, true); break;
+    case insn_remu:   rd = build_div(rs1, rs2, t_i64, false, true); break;
+    case insn_sub:    rd = LLVMBuildSub(bld, rs1, rs2, ""); break;
+    case insn_sra:    rd = build_shift(LLVMAShr, rs1, rs2, true); break;
+    case insn_lui:    rd = imm; break;
+    case insn_addw:   rd = sext32(LLVMBuildAdd(bld, rs1, rs2, "")); break;
+    case insn_sllw:   rd = build_shift(LLVMShl, rs1, rs2, false); break;
+    case insn_srlw:   rd = build_shift(LLVMLShr, rs1, rs2, false); break;
+    case insn_mulw:   rd = sext32(LLVMBuildMul(bld, rs1, rs2, "")); break;
+    case insn_divw:   rd = LLVMBuildSExt(bld, build_div(rs1w, rs2w, t_i32, true, false), t_i64, ""); break;
+    case insn_divuw:  rd = LLVMBuildSExt(bld, build_div(rs1w, rs2w, t_i32, false, false), t_i64, ""); break;
+    case insn_remw:   rd = LLVMBuildSExt(bld, build_div(rs1w, rs2w, t_i32, true, true), t_i64, ""); break;
+    case insn_remuw:  rd = LLVMBuildSExt(bld, build_div(rs1w, rs2w, t_i32, false, true), t_i64, ""); break;
+    case insn_subw:   rd = sext32(LLVMBuildSub(bld, rs1, rs2, "")); break;
+    case insn_sraw:   rd = build_shift(LLVMAShr, rs1, rs2, false); break;
+    case insn_beq:
+    case insn_bne:
+    case insn_blt:
+    case insn_bge:
+    case insn_bltu:
+    case insn_bgeu: {
+        static const LLVMIntPredicate preds[] = {
+            LLVMIntEQ, LLVMIntNE, LLVMIntSLT, LLVMIntSGE, LLVMIntULT, LLVMIntUGE,
+        };
+        LLVMValueRef cond = LLVMBuildICmp(bld, preds[insn->type - insn_beq], rs1, rs2, "");
+        u64 target = e->pc + (i64)insn->imm;
+        set_weights(LLVMBuildCondBr(bld, cond, bb_of(target), bb_of(next_pc)), target, next_pc);
+        return;
+    }
+    case insn_zext:
+        rd = LLVMBuildLShr(bld, LLVMBuildShl(bld, rs1, c64(insn->imm & 0x3f), ""), c64(insn->imm & 0x3f), "");
+        break;
+    case insn_ld_pc:
+        rd = LLVMBuildLoad2(bld, t_i64, guest_ptr(c64(e->pc + (i64)insn->imm), t_i64), "");
+        LLVMSetAlignment(rd, 1);
+        break;
+    case insn_jal:
+        set_reg(insn->rd, c64(next_pc));
+        LLVMBuildBr(bld, bb_of(e->pc + (i64)insn->imm));
+        return;
+    case insn_jalr: {
+        LLVMValueRef target = LLVMBuildAnd(bld, LLVMBuildAdd(bld, rs1, imm, ""), c64(~1ULL), "");
+        set_reg(insn->rd, c64(next_pc));
+        exit_block(indirect_branch, target);
+        return;
+    }
+    case insn_ecall:
+        build_ecall();
+        break;
+    default:
+        unreachable();
+    }
+
+    if (rd) set_reg(insn->rd, rd);
+    LLVMBuildBr(bld, bb_of(next_pc));
+}
+
+// ============================================================================== //
+// 编译
+// ============================================================================== //
+
+static void llvm_init(void) {
+    LLVMInitializeNativeTarget();
+    LLVMInitializeNativeAsmPrinter();
+
+    char *triple = LLVMGetDefaultTargetTriple();
+    char *cpu = LLVMGetHostCPUName();
+    char *features = LLVMGetHostCPUFeatures();
+    LLVMTargetRef target;
+    char *err = NULL;
+    if (LLVMGetTargetFromTriple(triple, &target, &err)) fatal(err);
+    // 小代码模型下常量池使用 R_X86_64_PC32：machine_link 可以处理
+    tm = LLVMCreateTargetMachine(target, triple, cpu, features, LLVMCodeGenLevelAggressive,
+                                 LLVMRelocPIC, LLVMCodeModelSmall);
+    LLVMDisposeMessage(triple);
+    LLVMDisposeMessage(cpu);
+    LLVMDisposeMessage(features);
+
+    ctx = LLVMContextCreate();
+    t_void = LLVMVoidTypeInContext(ctx);
+    t_i1 = LLVMInt1TypeInContext(ctx);
+    t_i8 = LLVMInt8TypeInContext(ctx);
+    t_i16 = LLVMInt16TypeInContext(ctx);
+    t_i32 = LLVMInt32TypeInContext(ctx);
+    t_i64 = LLVMInt64TypeInContext(ctx);
+    t_i128 = LLVMInt128TypeInContext(ctx);
+    LLVMTypeRef p_i8 = LLVMPointerType(t_i8, 0);
+    t_syscall = LLVMFunctionType(t_i64, &p_i8, 1, false);
+    bld = LLVMCreateBuilderInContext(ctx);
+}
+
+/// @brief 构造代码块函数 void block(state_t *state)
+static LLVMModuleRef llvm_build(void) {
+    LLVMModuleRef mod = LLVMModuleCreateWithNameInContext("temu", ctx);
+    LLVMTargetDataRef layout = LLVMCreateTargetDataLayout(tm);
+    LLVMSetModuleDataLayout(mod, layout);
+    LLVMDisposeTargetData(layout);
+    char *triple = LLVMGetTargetMachineTriple(tm);
+    LLVMSetTarget(mod, triple);
+    LLVMDisposeMessage(triple);
+
+    LLVMTypeRef p_i8 = LLVMPointerType(t_i8, 0);
+    LLVMValueRef func = LLVMAddFunction(mod, "block", LLVMFunctionType(t_void, &p_i8, 1, false));
+    state = LLVMGetParam(func, 0);
+
+    LLVMBasicBlockRef entry = LLVMAppendBasicBlockInContext(ctx, func, "entry");
+    for (u64 i = 0; i < ninsns; i++)
+        bbs[i] = LLVMAppendBasicBlockInContext(ctx, func, "");
+    end_bb = LLVMAppendBasicBlockInContext(ctx, func, "end");
+
+    // 入口：guest 寄存器读入局部变量
+    LLVMPositionBuilderAtEnd(bld, entry);
+    for (int r = 1; r < num_gp_regs; r++) {
+        regs[r] = LLVMBuildAlloca(bld, t_i64, "");
+        LLVMValueRef p = state_field(offsetof(state_t, gp_regs) + 8 * r, t_i64);
+        LLVMBuildStore(bld, LLVMBuildLoad2(bld, t_i64, p, ""), regs[r]);
+    }
+
+    // 入口处已经有效的栈槽：之后一定会访问，先读取
+    u64 nslots = 0;
+    slots = ir_slots(&nslots);
+    for (u64 k = 0; k < nslots; k++)
+        slot_vars[k] = LLVMBuildAlloca(bld, t_i64, "");
+    slot_reload(insns[0].avail);
+    LLVMBuildBr(bld, bbs[0]);
+
+    for (u64 i = 0; i < ninsns; i++) build_insn(i);
+
+    // 出口：写回 guest 寄存器
+    LLVMPositionBuilderAtEnd(bld, end_bb);
+    for (int r = 1; r < num_gp_regs; r++)
+        LLVMBuildStore(bld, get_reg(r), state_field(offsetof(state_t, gp_regs) + 8 * r, t_i64));
+    LLVMBuildRetVoid(bld);
+    return mod;
+}
+
+u8 *machine_llvm(machine_t *m) {
+    if (tm == NULL) llvm_init();
+
+    struct timespec t0, t1;
+    if (TEMU_STATS) clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if (!llvm_discover(m->state.pc, m->cache)) {
+        stats.fallbacks++;
+        return NULL;
+    }
+
+    LLVMModuleRef mod = llvm_build();
+    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
+    LLVMErrorRef err = LLVMRunPasses(mod, LLVM_PASSES, tm, opts);
+    LLVMDisposePassBuilderOptions(opts);
+    if (err) fatal(LLVMGetErrorMessage(err));
+
+    char *msg = NULL;
+    LLVMMemoryBufferRef obj;
+    if (LLVMTargetMachineEmitToMemoryBuffer(tm, mod, LLVMObjectFile, &msg, &obj)) fatal(msg);
+    LLVMDisposeModule(mod);
+
+    u8 *elf = (u8 *)LLVMGetBufferStart(obj);
+    machine_link(m, elf, LLVMGetBufferSize(obj));
+    u8 *code = machine_symbol(elf, "block");
+    cache_set(m->cache, m->state.pc, code);
+    LLVMDisposeMemoryBuffer(obj);
+
+    if (TEMU_STATS) {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        stats.regions++;
+        stats.ns += (t1.tv_sec - t0.tv_sec) * 1000000000ul + (t1.tv_nsec - t0.tv_nsec);
+    }
+    return code;
+}
+
+void llvm_report(void) {
+    if (stats.regions == 0) return;
+    fprintf(stderr, "llvm: %lu regions, %.3f ms/region, %lu fallbacks\n",
+            stats.regions, stats.ns / 1e6 / stats.regions, stats.fallbacks);
+}
+
+#else
+
+u8 *machine_llvm(machine_t *m) {
+    return NULL;
+}
+
+void llvm_report(void) {}
+
+#endif
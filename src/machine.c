@@ -7,6 +7,7 @@
 
 enum exit_reason_t machine_step(machine_t *m)
 {
+    fenv_enter(&m->state);  // 客户代码使用自己的 MXCSR：浮点指令直接累积异常标志
     while (true) // 虚拟机外层循环
     {
         bool hot = true;
@@ -17,8 +18,19 @@ enum exit_reason_t machine_step(machine_t *m)
             hot = cache_hot(m->cache, m->state.pc);     // 判断是否热代码
             if (hot)
             {                                            // 如果是热代码，则生成代码
-                str_t source = machine_genblock(m);     // 生成代码块
-                code = machine_compile(m, source);      // 编译代码块
+                fenv_leave(&m->state);                          // 编译器使用主机的浮点环境
+                code = EMIT_NATIVE ? machine_emit(m) : NULL;    // 直接生成机器码
+                if (code == NULL && COMPILE_LLVM)
+                    code = machine_llvm(m);                     // 进程内 LLVM 编译
+                if (code == NULL) {
+                    // 快要变热的代码块一起编译
+                    static entries_t entries[COMPILE_BATCH];
+                    u64 pcs[COMPILE_BATCH] = { m->state.pc };
+                    u64 n = 1 + cache_warm(m->cache, pcs + 1, COMPILE_BATCH - 1);
+                    str_t source = machine_genblock(m, pcs, n, entries);    // 生成代码块
+                    code = machine_compile(m, source, entries, n);          // 编译代码块
+                }
+                fenv_enter(&m->state);
             }
         }
 
@@ -26,13 +38,18 @@ enum exit_reason_t machine_step(machine_t *m)
         {   // 设置代码块解释执行
             code = (u8 *)exec_block_interp;
         }
+        // 多入口代码块按 reenter_pc 选择入口
+        m->state.reenter_pc = m->state.pc;
 
         while (true) // 虚拟机内层循环
         {
             // 设置跳出内循环原因为 none
             m->state.exit_reason = none;
             // 执行代码块
-            ((exec_block_func_t)code)(&m->state);
+            if (EMIT_VERIFY && emit_is_native(code))
+                emit_verify(m, code);
+            else
+                ((exec_block_func_t)code)(&m->state);
             // 确保跳出原因非 none
             assert(m->state.exit_reason != none);
 
@@ -65,6 +82,7 @@ enum exit_reason_t machine_step(machine_t *m)
             // continue execution
             break;
         case ecall:
+            fenv_leave(&m->state);
             return ecall;
         default:
             unreachable();
@@ -90,8 +108,14 @@ void machine_load_program(machine_t *machine, char *prog)
 
 void machine_setup(machine_t *m, int argc, char *argv[])
 {
+    m->state.syscall = syscall_trampoline; // JIT 代码内直接处理系统调用
+    m->state.clock_gettime = syscall_clock_gettime;
+    m->state.gettimeofday = syscall_gettimeofday;
+    m->state.mxcsr = 0x1f80;    // 屏蔽所有浮点异常，舍入到最近：与 fcsr 为 0 对应
+    syscall_setup(m);
     size_t stack_size = 32 * 1024 * 1024; // 32MB 栈
     u64 stack = mmu_alloc(&m->mmu, stack_size);
+    if (stack == 0) fatal("cannot allocate guest stack");
     m->state.gp_regs[sp] = stack + stack_size; // 栈指针寄存器
     m->state.gp_regs[sp] -= 8;                 // auxv
     m->state.gp_regs[sp] -= 8;                 // envp
@@ -101,6 +125,7 @@ void machine_setup(machine_t *m, int argc, char *argv[])
     {
         size_t len = strlen(argv[i]);
         u64 addr = mmu_alloc(&m->mmu, len + 1);
+        if (addr == 0) fatal("cannot allocate guest argv");
         mmu_write(addr, (u8 *)argv[i], len); // 将参数数据存到heap上
         m->state.gp_regs[sp] -= 8;           // argv[i]
         // 将 addr 地址值存入寄存器指向的地址（取地址的地址）
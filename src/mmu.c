@@ -25,6 +25,29 @@ static int flags_to_mmap_prot(u32 flags) {
            (flags & PF_X ? PROT_EXEC: 0);
 }
 
+/// @brief 按策略映射匿名内存：预先填充或懒惰填充，大块内存提示使用透明大页
+/// @param host_addr 主机地址（页对齐）
+/// @param len 映射长度（页对齐）
+/// @param prot 访问权限
+static void mmu_map_anon(u64 host_addr, u64 len, int prot) {
+    int flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED;
+    // 大页提示要在缺页之前给出，所以大块内存不能直接 MAP_POPULATE
+    bool huge = len >= MMU_HUGEPAGE_THRESHOLD;
+    if (MMU_POPULATE && !huge) flags |= MAP_POPULATE;
+
+    if (mmap((void *)host_addr, len, prot, flags, -1, 0) != (void *)host_addr)
+        fatal(strerror(errno));
+
+    if (huge) {
+        madvise((void *)host_addr, len, MADV_HUGEPAGE);
+#ifdef MADV_POPULATE_WRITE
+        // WILLNEED 不会预先分配匿名内存：大页提示之后再按写入预先填充
+        if (MMU_POPULATE)
+            madvise((void *)host_addr, len, prot & PROT_WRITE ? MADV_POPULATE_WRITE : MADV_POPULATE_READ);
+#endif
+    }
+}
+
 /// @brief 加载 program header 的 segment 到内存
 /// @param mmu 内存对象
 /// @param phdr program header 对象
@@ -37,16 +60,21 @@ static void mmu_load_segment(mmu_t *mmu, elf64_phdr_t *phdr, int fd) {
     u64 filesz = phdr->p_filesz + (vaddr - aligned_vaddr);
     u64 memsz = phdr->p_memsz + (vaddr - aligned_vaddr);
     // mmap page aligned: 对齐 page size
+    // 文件映射不拷贝数据，预先填充只是提前建立页表
     int prot = flags_to_mmap_prot(phdr->p_flags);
-    u64 addr = (u64)mmap((void *)aligned_vaddr, filesz, prot, MAP_PRIVATE | MAP_FIXED, 
+    int flags = MAP_PRIVATE | MAP_FIXED | (MMU_POPULATE ? MAP_POPULATE : 0);
+    u64 addr = (u64)mmap((void *)aligned_vaddr, filesz, prot, flags,
                         fd, ROUNDDOWN(offset, page_size));
     assert(addr == aligned_vaddr);
+    // 文件最后一页中 filesz 之后的部分属于 .bss，需要清零
+    if (phdr->p_memsz > phdr->p_filesz && (prot & PROT_WRITE)) {
+        u64 bss_start = vaddr + phdr->p_filesz;
+        memset((void *)bss_start, 0, ROUNDUP(bss_start, page_size) - bss_start);
+    }
     // .bss section
     u64 remaining_bss = ROUNDUP(memsz, page_size) - ROUNDUP(filesz, page_size);
     if (remaining_bss > 0) {
-        u64 addr = (u64)mmap((void *)(aligned_vaddr + ROUNDUP(filesz, page_size)),
-             remaining_bss, prot, MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
-        assert(addr == aligned_vaddr + ROUNDUP(filesz, page_size));
+        mmu_map_anon(aligned_vaddr + ROUNDUP(filesz, page_size), remaining_bss, prot);
     }
 
     mmu->host_alloc = MAX(mmu->host_alloc, (aligned_vaddr + ROUNDUP(memsz, page_size)));
@@ -55,6 +83,11 @@ static void mmu_load_segment(mmu_t *mmu, elf64_phdr_t *phdr, int fd) {
 
 
 void mmu_load_elf(mmu_t *mmu, int fd) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    mmu->minflt = usage.ru_minflt;
+    mmu->majflt = usage.ru_majflt;
+
     u8 buf[sizeof(elf64_ehdr_t)];
     FILE *file = fdopen(fd, "rb");  // 二进制只读
     if(fread(buf, 1, sizeof(elf64_ehdr_t), file) != sizeof(elf64_ehdr_t)) {
@@ -90,24 +123,171 @@ void mmu_load_elf(mmu_t *mmu, int fd) {
 }
 
 
+/// @brief 预留堆区：一次映射 `PROT_NONE` 的大块地址空间，之后只提交/释放
+/// @param mmu 内存对象
+static void mmu_reserve(mmu_t *mmu) {
+    void *addr = mmap((void *)mmu->host_alloc, MMU_HEAP_RESERVE, PROT_NONE,
+                      MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (addr != (void *)mmu->host_alloc)
+        fatal("cannot reserve guest heap");
+    // 大页提示作用在整个预留区上，之后 mprotect 拆分出的区域都会保留
+    madvise(addr, MMU_HEAP_RESERVE, MADV_HUGEPAGE);
+    mmu->host_reserve = mmu->host_alloc + MMU_HEAP_RESERVE;
+    mmu->host_mmap = mmu->host_reserve;
+    mmu->host_dirty = mmu->host_alloc;
+}
+
+/// @brief 提交预留区中的内存：页面在第一次访问时才分配
+/// @param host_addr 主机地址（页对齐）
+/// @param len 提交长度（页对齐）
+static void mmu_commit(u64 host_addr, u64 len) {
+    if (mprotect((void *)host_addr, len, PROT_READ | PROT_WRITE) != 0)
+        fatal(strerror(errno));
+#ifdef MADV_POPULATE_WRITE
+    if (MMU_POPULATE) madvise((void *)host_addr, len, MADV_POPULATE_WRITE);
+#endif
+}
+
 u64 mmu_alloc(mmu_t *mmu, i64 sz) {
-    int page_size = getpagesize();
     u64 base = mmu->alloc;
     assert(base >= mmu->base);
+    if (mmu->host_reserve == 0) mmu_reserve(mmu);
 
+    assert(base + sz >= mmu->base);
+    u64 end = TO_HOST(base + sz);
+    if (end > mmu->host_mmap) return 0;     // 与 mmap 区相遇：与 Linux 一样只是失败，malloc 会改用 mmap
     mmu->alloc += sz;
-    assert(mmu->alloc >= mmu->base);
-    if (sz > 0 && mmu->alloc > TO_GUEST(mmu->host_alloc)) {
-        if (mmap((void *)mmu->host_alloc, ROUNDUP(sz, page_size),
-                 PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0) == MAP_FAILED)
-            fatal("mmap failed");
-        mmu->host_alloc += ROUNDUP(sz, page_size);
-    } else if (sz < 0 && ROUNDUP(mmu->alloc, page_size) < TO_GUEST(mmu->host_alloc)) {
-        u64 len = TO_GUEST(mmu->host_alloc) - ROUNDUP(mmu->alloc, page_size);
-        if (munmap((void *)mmu->host_alloc, len) == -1)
+
+    if (end > mmu->host_alloc) {
+        // 按块提交，避免每次 brk 增长都要系统调用
+        u64 commit_end = MIN(ROUNDUP(end, MMU_COMMIT_CHUNK), mmu->host_mmap);
+        mmu_commit(mmu->host_alloc, commit_end - mmu->host_alloc);
+        mmu->host_alloc = commit_end;
+    } else if (mmu->host_alloc - end > MMU_RELEASE_THRESHOLD) {
+        // 滞后释放：空闲超过阈值才归还给系统，保留一个提交块
+        u64 keep_end = ROUNDUP(end, MMU_COMMIT_CHUNK);
+        u64 len = mmu->host_alloc - keep_end;
+        madvise((void *)keep_end, len, MADV_DONTNEED);
+        if (mprotect((void *)keep_end, len, PROT_NONE) != 0)
             fatal(strerror(errno));
-        mmu->host_alloc -= len;
+        mmu->host_alloc = keep_end;
+        mmu->host_dirty = MIN(mmu->host_dirty, keep_end);
+    }
+
+    // 收缩后没有归还的内存里还留着旧数据：重新分配给客户程序前清零
+    if (sz > 0) {
+        u64 start = TO_HOST(base);
+        if (start < mmu->host_dirty)
+            memset((void *)start, 0, MIN(end, mmu->host_dirty) - start);
+        mmu->host_dirty = MAX(mmu->host_dirty, end);
     }
 
     return base;
-}
\ No newline at end of file
+}
+
+/// @brief 从空洞中去掉 [start, end)：可能把一个空洞分成两个
+static void hole_remove(mmu_t *mmu, u64 start, u64 end) {
+    for (u64 i = 0; i < mmu->nholes; i++) {
+        mmu_hole_t *h = &mmu->holes[i];
+        if (h->end <= start || h->start >= end) continue;
+        if (h->start < start && h->end > end) {
+            if (mmu->nholes == MMU_MAX_HOLES) {
+                h->end = start;     // 记不下后一半：不再复用
+                continue;
+            }
+            memmove(h + 2, h + 1, (mmu->nholes - i - 1) * sizeof(*h));
+            mmu->nholes++;
+            h[1].start = end;
+            h[1].end = h->end;
+            h->end = start;
+            i++;
+        } else if (h->start < start) {
+            h->end = start;
+        } else if (h->end > end) {
+            h->start = end;
+        } else {
+            memmove(h, h + 1, (mmu->nholes - i - 1) * sizeof(*h));
+            mmu->nholes--;
+            i--;
+        }
+    }
+}
+
+/// @brief 加入空洞 [start, end)：与相邻的空洞合并，最低的空洞并入 host_mmap 之下的未用空间
+static void hole_add(mmu_t *mmu, u64 start, u64 end) {
+    hole_remove(mmu, start, end);
+    u64 i = 0;
+    while (i < mmu->nholes && mmu->holes[i].start < start) i++;
+    bool prev = i > 0 && mmu->holes[i - 1].end == start;
+    bool next = i < mmu->nholes && mmu->holes[i].start == end;
+    if (prev && next) {
+        mmu->holes[i - 1].end = mmu->holes[i].end;
+        memmove(&mmu->holes[i], &mmu->holes[i + 1], (mmu->nholes - i - 1) * sizeof(mmu_hole_t));
+        mmu->nholes--;
+    } else if (prev) {
+        mmu->holes[i - 1].end = end;
+    } else if (next) {
+        mmu->holes[i].start = start;
+    } else if (start == mmu->host_mmap) {
+        mmu->host_mmap = end;
+    } else if (mmu->nholes < MMU_MAX_HOLES) {
+        memmove(&mmu->holes[i + 1], &mmu->holes[i], (mmu->nholes - i) * sizeof(mmu_hole_t));
+        mmu->holes[i].start = start;
+        mmu->holes[i].end = end;
+        mmu->nholes++;
+    }
+    if (mmu->nholes > 0 && mmu->holes[0].start == mmu->host_mmap) {
+        mmu->host_mmap = mmu->holes[0].end;
+        memmove(&mmu->holes[0], &mmu->holes[1], (mmu->nholes - 1) * sizeof(mmu_hole_t));
+        mmu->nholes--;
+    }
+}
+
+u64 mmu_mmap(mmu_t *mmu, u64 len) {
+    len = ROUNDUP(len, (u64)getpagesize());
+    if (mmu->host_reserve == 0) mmu_reserve(mmu);
+
+    // 先复用空洞：从空洞顶部取，剩下的部分仍是空洞
+    for (u64 i = 0; i < mmu->nholes; i++) {
+        mmu_hole_t *h = &mmu->holes[i];
+        if (h->end - h->start < len) continue;
+        u64 host_addr = h->end - len;
+        hole_remove(mmu, host_addr, h->end);
+        mmu_commit(host_addr, len);
+        return TO_GUEST(host_addr);
+    }
+
+    if (mmu->host_mmap - mmu->host_alloc < len) return 0;
+    mmu->host_mmap -= len;
+    mmu_commit(mmu->host_mmap, len);
+    return TO_GUEST(mmu->host_mmap);
+}
+
+void mmu_munmap(mmu_t *mmu, u64 addr, u64 len) {
+    len = ROUNDUP(len, (u64)getpagesize());
+    u64 host_addr = TO_HOST(addr);
+    // 重新映射为预留状态：同时丢弃数据，文件映射也会被替换
+    if (mmap((void *)host_addr, len, PROT_NONE,
+             MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+        fatal(strerror(errno));
+    // host_mmap 之下本来就没有使用
+    u64 start = MAX(host_addr, mmu->host_mmap);
+    if (start < host_addr + len) hole_add(mmu, start, host_addr + len);
+}
+
+void mmu_mmap_fixed(mmu_t *mmu, u64 addr, u64 len) {
+    u64 start = TO_HOST(addr), end = start + ROUNDUP(len, (u64)getpagesize());
+    hole_remove(mmu, start, end);
+    if (start >= mmu->host_mmap) return;
+    // 在 mmap 区之下：mmap 区向下扩展到它，中间没有用到的部分成为空洞
+    u64 old = mmu->host_mmap;
+    mmu->host_mmap = start;
+    if (end < old) hole_add(mmu, end, old);
+}
+
+void mmu_report(mmu_t *mmu) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(stderr, "mmu: %ld minor faults, %ld major faults\n",
+            usage.ru_minflt - mmu->minflt, usage.ru_majflt - mmu->majflt);
+}
@@ -18,6 +18,9 @@ bool set_has(set_t *set, u64 elem) {
         if (set->table[index] == elem) {
             return true;
         }
+
+        index++;
+        index = hash(index);
     }
 
     return false;
@@ -5,63 +5,80 @@
 
 #include "temu.h"
 
+#include <asm/unistd.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/random.h>
+#include <sys/sysinfo.h>
+#include <sys/times.h>
+#include <sys/utsname.h>
+
 
 // Copied from https://github.com/riscv-software-src/riscv-pk
-#define SYS_exit 93
-#define SYS_exit_group 94
-#define SYS_getpid 172
-#define SYS_kill 129
-#define SYS_tgkill 131
-#define SYS_read 63
-#define SYS_write 64
-#define SYS_openat 56
-#define SYS_close 57
-#define SYS_lseek 62
-#define SYS_brk 214
-#define SYS_linkat 37
-#define SYS_unlinkat 35
+// and linux/include/uapi/asm-generic/unistd.h
+#define SYS_getcwd 17
+#define SYS_dup 23
+#define SYS_dup3 24
+#define SYS_fcntl 25
+#define SYS_ioctl 29
 #define SYS_mkdirat 34
+#define SYS_unlinkat 35
+#define SYS_linkat 37
 #define SYS_renameat 38
-#define SYS_chdir 49
-#define SYS_getcwd 17
-#define SYS_fstat 80
-#define SYS_fstatat 79
+#define SYS_ftruncate 46
 #define SYS_faccessat 48
+#define SYS_chdir 49
+#define SYS_openat 56
+#define SYS_close 57
+#define SYS_getdents64 61
+#define SYS_lseek 62
+#define SYS_read 63
+#define SYS_write 64
+#define SYS_readv 65
+#define SYS_writev 66
 #define SYS_pread 67
 #define SYS_pwrite 68
+#define SYS_readlinkat 78
+#define SYS_fstatat 79
+#define SYS_fstat 80
+#define SYS_fsync 82
+#define SYS_exit 93
+#define SYS_exit_group 94
+#define SYS_set_tid_address 96
+#define SYS_set_robust_list 99
+#define SYS_nanosleep 101
+#define SYS_clock_gettime 113
+#define SYS_clock_getres 114
+#define SYS_sched_yield 124
+#define SYS_kill 129
+#define SYS_tgkill 131
+#define SYS_rt_sigaction 134
+#define SYS_rt_sigprocmask 135
+#define SYS_times 153
 #define SYS_uname 160
+#define SYS_getrlimit 163
+#define SYS_setrlimit 164
+#define SYS_getrusage 165
+#define SYS_gettimeofday 169
+#define SYS_getpid 172
+#define SYS_getppid 173
 #define SYS_getuid 174
 #define SYS_geteuid 175
 #define SYS_getgid 176
 #define SYS_getegid 177
 #define SYS_gettid 178
 #define SYS_sysinfo 179
-#define SYS_mmap 222
+#define SYS_brk 214
 #define SYS_munmap 215
 #define SYS_mremap 216
+#define SYS_mmap 222
 #define SYS_mprotect 226
-#define SYS_prlimit64 261
-#define SYS_getmainvars 2011
-#define SYS_rt_sigaction 134
-#define SYS_writev 66
-#define SYS_gettimeofday 169
-#define SYS_times 153
-#define SYS_fcntl 25
-#define SYS_ftruncate 46
-#define SYS_getdents 61
-#define SYS_dup 23
-#define SYS_dup3 24
-#define SYS_readlinkat 78
-#define SYS_rt_sigprocmask 135
-#define SYS_ioctl 29
-#define SYS_getrlimit 163
-#define SYS_setrlimit 164
-#define SYS_getrusage 165
-#define SYS_clock_gettime 113
-#define SYS_set_tid_address 96
-#define SYS_set_robust_list 99
 #define SYS_madvise 233
+#define SYS_prlimit64 261
+#define SYS_renameat2 276
+#define SYS_getrandom 278
 #define SYS_statx 291
+#define SYS_getmainvars 2011
 
 #define OLD_SYSCALL_THRESHOLD 1024
 #define SYS_open 1024
@@ -73,17 +90,244 @@
 #define SYS_lstat 1039
 #define SYS_time 1062
 
+// glibc 只在 _GNU_SOURCE 下定义
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH 0x1000
+#endif
+
 /// 获取寄存器值
 #define GET(reg, name) u64 name = machine_get_gp_reg(m, reg);
 
+/// 客户地址转换为主机指针：0 仍然是 NULL
+#define HOST_PTR(addr) ((addr) ? (void *)TO_HOST(addr) : NULL)
+
 /// syscall函数指针
 typedef u64 (* syscall_t)(machine_t *);
 
-/// @brief 未实现方法
-/// @param m 虚拟机对象
-/// @return 
-static u64 sys_unimplemented(machine_t *m) {
-    fatalf("unimplemented syscall: %lu", machine_get_gp_reg(m, a7));
+/// @brief 系统调用表项
+typedef struct {
+    syscall_t func;     // 处理函数
+    const char *name;   // 名称：用于统计输出
+    u64 count;          // 调用次数：TEMU_STATS 时记录
+    u64 ns;             // 累计主机耗时：TEMU_STATS 时记录
+} syscall_entry_t;
+
+/// @brief 主机返回值转换为 Linux 约定：失败时返回 -errno
+static inline u64 host_ret(i64 ret) {
+    return ret < 0 ? (u64)-errno : (u64)ret;
+}
+
+// ============================================================================== //
+// 文件描述符表：客户 fd 映射到主机 fd，每个客户 fd 独占一个主机 fd（0/1/2 除外）
+// ============================================================================== //
+
+void syscall_setup(machine_t *m) {
+    fdtable_t *fdt = &m->fdt;
+    for (u64 fd = 0; fd < SYSCALL_FD_MAX; fd++) fdt->fds[fd].host = FD_CLOSED;
+    for (int fd = STDIN_FILENO; fd <= STDERR_FILENO; fd++) fdt->fds[fd].host = fd;
+    if (SYSCALL_OUTBUF) {
+        for (int i = 0; i < 2; i++) {
+            fdt->outbufs[i].host = STDOUT_FILENO + i;
+            fdt->fds[STDOUT_FILENO + i].outbuf = &fdt->outbufs[i];
+        }
+        fdt->outbufs[1].unbuffered = true;
+    }
+}
+
+/// @brief 取得客户 fd 的表项
+/// @return NULL 表示 fd 无效或未打开
+static fd_t *fd_get(machine_t *m, u64 fd) {
+    if (fd >= SYSCALL_FD_MAX || m->fdt.fds[fd].host == FD_CLOSED) return NULL;
+    return &m->fdt.fds[fd];
+}
+
+/// @brief 客户 fd 转换为主机 fd：无效时返回负数，主机调用随之以 EBADF 失败
+static int fd_host(machine_t *m, u64 fd) {
+    fd_t *f = fd_get(m, fd);
+    return f ? f->host : FD_CLOSED;
+}
+
+/// @brief 客户目录 fd 转换为主机 fd：AT_FDCWD 原样保留
+static int dirfd_host(machine_t *m, u64 dirfd) {
+    return (int)dirfd == AT_FDCWD ? AT_FDCWD : fd_host(m, dirfd);
+}
+
+/// @brief 分配不小于 min 的最小空闲客户 fd
+/// @param host 主机 fd 或 FD_VFS
+/// @return NULL 表示没有空闲的 fd
+static fd_t *fd_alloc(machine_t *m, int host, u64 min) {
+    for (u64 fd = min; fd < SYSCALL_FD_MAX; fd++) {
+        fd_t *f = &m->fdt.fds[fd];
+        if (f->host != FD_CLOSED) continue;
+        memset(f, 0, sizeof(*f));
+        f->host = host;
+        return f;
+    }
+    return NULL;
+}
+
+/// @brief 为主机 fd 分配不小于 min 的最小空闲客户 fd
+/// @param host 主机 fd：负数表示主机调用失败
+/// @return 系统调用返回值：客户 fd 或 -errno
+static u64 fd_install(machine_t *m, int host, u64 min) {
+    if (host < 0) return host_ret(host);
+    fd_t *f = fd_alloc(m, host, min);
+    if (f) return f - m->fdt.fds;
+    close(host);
+    return -EMFILE;
+}
+
+/// @brief 取得 fd 的 fstat 结果：缓存到下一次写入
+/// @return NULL 表示 fstat 失败
+static struct stat *fd_stat(machine_t *m, fd_t *f) {
+    if (f->stat_gen != m->fdt.write_gen + 1) {
+        if (fstat(f->host, &f->st) < 0) return NULL;
+        f->stat_gen = m->fdt.write_gen + 1;     // 加 1：新表项的 0 总是无效
+    }
+    return &f->st;
+}
+
+/// @brief 通过 fd 写入之后调用：fstat 缓存与 vfs 中同一文件的缓存失效
+static void fd_written(machine_t *m, fd_t *f) {
+    if (SYSCALL_VFS) {
+        struct stat *st = fd_stat(m, f);
+        if (st) vfs_invalidate_inode(st->st_dev, st->st_ino);
+    }
+    m->fdt.write_gen++;
+}
+
+// ============================================================================== //
+// 异步写入：普通文件的写入交给 io_uring，其他系统调用之前等待完成
+// ============================================================================== //
+
+/// @brief 判断 fd 能否异步写入：普通文件，可写且不是追加模式
+static bool afile_check(machine_t *m, fd_t *f) {
+    if (f->kind == 0) {
+        struct stat *st = fd_stat(m, f);
+        int flags = fcntl(f->host, F_GETFL);
+        bool ok = st && S_ISREG(st->st_mode) && flags != -1 &&
+                  (flags & O_ACCMODE) != O_RDONLY && !(flags & O_APPEND);
+        f->kind = ok ? 1 : -1;
+    }
+    return f->kind == 1;
+}
+
+/// @brief 等待所有异步写入完成，并把主机文件位置同步到写入之后
+static void afile_drain(machine_t *m) {
+    fdtable_t *fdt = &m->fdt;
+    if (fdt->dirty == 0) return;
+    uring_drain();
+    for (u64 fd = 0; fd < SYSCALL_FD_MAX && fdt->dirty; fd++) {
+        fd_t *f = &fdt->fds[fd];
+        if (!f->dirty) continue;
+        lseek(f->host, f->pos, SEEK_SET);
+        f->dirty = false;
+        fdt->dirty--;
+    }
+}
+
+/// @brief 尝试异步写入：按显式偏移量提交，完成顺序不影响文件内容
+/// @return 是否已提交
+static bool afile_write(machine_t *m, fd_t *f, const void *data, u64 len) {
+    if (!afile_check(m, f)) return false;
+    // 其他 fd 还有在途的写入：dup 出来的 fd 共用主机的文件位置，先等它们完成
+    if (!f->dirty && m->fdt.dirty) afile_drain(m);
+    if (!f->dirty) {
+        f->pos = lseek(f->host, 0, SEEK_CUR);
+        if (f->pos < 0) return false;
+    }
+    if (!uring_write(f->host, data, len, f->pos)) return false;
+    f->pos += len;
+    if (!f->dirty) m->fdt.dirty++;
+    f->dirty = true;
+    fd_written(m, f);
+    return true;
+}
+
+// ============================================================================== //
+// 标准输出缓冲：合并客户程序对 stdout/stderr 的小块写入
+// ============================================================================== //
+
+/// @brief 将缓冲数据写出
+static void outbuf_flush(outbuf_t *ob) {
+    u64 done = 0;
+    while (done < ob->len) {
+        ssize_t n = write(ob->host, ob->buf + done, ob->len - done);
+        if (n <= 0) break;
+        done += n;
+    }
+    if (SYSCALL_VFS && ob->regular && done > 0) vfs_invalidate_inode(ob->dev, ob->ino);
+    ob->len = 0;
+}
+
+/// @brief 缓冲写入：切换到另一个缓冲区时先刷新，保证 stdout/stderr 的输出顺序
+/// @return 写入长度
+static u64 outbuf_write(machine_t *m, outbuf_t *ob, const char *data, u64 len) {
+    if (!ob->init) {
+        struct stat st;
+        ob->tty = isatty(ob->host);
+        ob->regular = fstat(ob->host, &st) == 0 && S_ISREG(st.st_mode);
+        ob->dev = st.st_dev;
+        ob->ino = st.st_ino;
+        ob->init = true;
+    }
+    fdtable_t *fdt = &m->fdt;
+    if (fdt->last_out != ob) {
+        if (fdt->last_out) outbuf_flush(fdt->last_out);
+        fdt->last_out = ob;
+    }
+
+    if (ob->len + len > SYSCALL_OUTBUF_SIZE) outbuf_flush(ob);
+    if (len >= SYSCALL_OUTBUF_SIZE) return write(ob->host, data, len);
+
+    memcpy(ob->buf + ob->len, data, len);
+    ob->len += len;
+    if (ob->unbuffered || (ob->tty && memchr(data, '\n', len))) outbuf_flush(ob);
+    return len;
+}
+
+void syscall_flush(machine_t *m) {
+    outbuf_flush(&m->fdt.outbufs[0]);
+    outbuf_flush(&m->fdt.outbufs[1]);
+    if (SYSCALL_URING) afile_drain(m);
+}
+
+/// @brief 打开文件前调用：重定向到普通文件的缓冲先写出，打开的可能正是这个文件
+static void outbuf_sync_files(machine_t *m) {
+    for (int i = 0; i < 2; i++)
+        if (m->fdt.outbufs[i].regular && m->fdt.outbufs[i].len) outbuf_flush(&m->fdt.outbufs[i]);
+}
+
+/// 直接访问主机 fd 前调用：读 stdin 或绕过缓冲写 stdout/stderr 时先刷新
+#define OUTBUF_SYNC(hfd) \
+    if (SYSCALL_OUTBUF && (hfd) >= 0 && (hfd) <= STDERR_FILENO) syscall_flush(m);
+
+/// @brief 释放客户 fd：主机的标准输入输出保持打开
+/// @return 系统调用返回值
+static u64 fd_release(machine_t *m, fd_t *f) {
+    if (f->outbuf) outbuf_flush(f->outbuf);
+    if (f->vopen) vfs_close(f->vopen);
+    int host = f->host;
+    f->host = FD_CLOSED;
+    if (host > STDERR_FILENO) return host_ret(close(host));
+    return 0;
+}
+
+/// @brief 复制客户 fd：新 fd 共用写入缓冲与 vfs 文件位置
+/// @param min 新客户 fd 的最小值
+/// @param cloexec 新主机 fd 是否设置 FD_CLOEXEC
+/// @return 系统调用返回值
+static u64 fd_dup(machine_t *m, fd_t *f, u64 min, bool cloexec) {
+    outbuf_t *ob = f->outbuf;
+    if (f->vopen) {
+        fd_t *g = fd_alloc(m, FD_VFS, min);
+        if (!g) return -EMFILE;
+        g->vopen = vfs_dup(f->vopen);
+        return g - m->fdt.fds;
+    }
+    u64 ret = fd_install(m, fcntl(f->host, cloexec ? F_DUPFD_CLOEXEC : F_DUPFD, 0), min);
+    if ((i64)ret >= 0) m->fdt.fds[ret].outbuf = ob;
+    return ret;
 }
 
 /**
@@ -101,8 +345,9 @@ static u64 sys_exit(machine_t *m) {
  */
 static u64 sys_close(machine_t *m) {
     GET(a0, fd);
-    if (fd > 2) return close(fd);
-    return 0;
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    return fd_release(m, f);
 }
 
 /**
@@ -111,7 +356,73 @@ static u64 sys_close(machine_t *m) {
  */
 static u64 sys_write(machine_t *m) {
     GET(a0, fd); GET(a1, ptr); GET(a2, len);
-    return write(fd, (void *)TO_HOST(ptr), (size_t)len);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    if (f->outbuf) {
+        m->fdt.write_gen++;     // fstat 缓存失效：vfs 缓存在写出到文件时失效
+        return host_ret(outbuf_write(m, f->outbuf, (char *)TO_HOST(ptr), len));
+    }
+    if (SYSCALL_URING) {
+        if (afile_write(m, f, (void *)TO_HOST(ptr), len)) return len;
+        afile_drain(m);
+    }
+    fd_written(m, f);
+    return host_ret(write(f->host, (void *)TO_HOST(ptr), (size_t)len));
+}
+
+// ============================================================================== //
+// 文件状态：客户程序使用 asm-generic 的 struct stat 布局，与 x86-64 主机不同
+// ============================================================================== //
+
+/// @brief riscv64 的 struct stat：共 128 字节
+typedef struct {
+    u64 dev;
+    u64 ino;
+    u32 mode;
+    u32 nlink;
+    u32 uid;
+    u32 gid;
+    u64 rdev;
+    u64 pad1;
+    i64 size;
+    i32 blksize;
+    i32 pad2;
+    i64 blocks;
+    i64 atime_sec;
+    u64 atime_nsec;
+    i64 mtime_sec;
+    u64 mtime_nsec;
+    i64 ctime_sec;
+    u64 ctime_nsec;
+    u32 unused4;
+    u32 unused5;
+} guest_stat_t;
+
+_Static_assert(sizeof(guest_stat_t) == 128, "guest struct stat must be 128 bytes");
+
+/// @brief 把主机 stat 结果写入客户内存
+/// @return 系统调用返回值
+static u64 stat_to_guest(int ret, struct stat *st, u64 addr) {
+    if (ret < 0) return host_ret(ret);
+    guest_stat_t *gst = (guest_stat_t *)TO_HOST(addr);
+    memset(gst, 0, sizeof(*gst));
+    gst->dev = st->st_dev;
+    gst->ino = st->st_ino;
+    gst->mode = st->st_mode;
+    gst->nlink = st->st_nlink;
+    gst->uid = st->st_uid;
+    gst->gid = st->st_gid;
+    gst->rdev = st->st_rdev;
+    gst->size = st->st_size;
+    gst->blksize = st->st_blksize;
+    gst->blocks = st->st_blocks;
+    gst->atime_sec = st->st_atim.tv_sec;
+    gst->atime_nsec = st->st_atim.tv_nsec;
+    gst->mtime_sec = st->st_mtim.tv_sec;
+    gst->mtime_nsec = st->st_mtim.tv_nsec;
+    gst->ctime_sec = st->st_ctim.tv_sec;
+    gst->ctime_nsec = st->st_ctim.tv_nsec;
+    return 0;
 }
 
 /**
@@ -121,140 +432,747 @@ static u64 sys_write(machine_t *m) {
  */
 static u64 sys_fstat(machine_t *m) {
     GET(a0, fd); GET(a1, addr);
-    return fstat(fd, (struct stat *)TO_HOST(addr));
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    struct stat *st = f->vopen ? &f->vopen->file->st : fd_stat(m, f);
+    return stat_to_guest(st ? 0 : -1, st, addr);
+}
+
+/**
+ * ret = fstatat(dirfd, path, addr, flags);
+ */
+static u64 sys_fstatat(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, addr); GET(a3, flags);
+    // glibc 的 fstat 使用 fstatat(fd, "", st, AT_EMPTY_PATH)
+    if ((flags & AT_EMPTY_PATH) && *(char *)TO_HOST(nameptr) == '\0' && (int)dirfd != AT_FDCWD)
+        return sys_fstat(m);
+    struct stat st;
+    return stat_to_guest(fstatat(dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), &st, flags), &st, addr);
 }
 
+static u64 sys_stat(machine_t *m) {
+    GET(a0, nameptr); GET(a1, addr);
+    struct stat st;
+    return stat_to_guest(stat((char *)TO_HOST(nameptr), &st), &st, addr);
+}
+
+static u64 sys_lstat(machine_t *m) {
+    GET(a0, nameptr); GET(a1, addr);
+    struct stat st;
+    return stat_to_guest(lstat((char *)TO_HOST(nameptr), &st), &st, addr);
+}
+
+/// struct statx 在各架构布局相同，直接转发
+static u64 sys_statx(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, flags); GET(a3, mask); GET(a4, addr);
+    return host_ret(syscall(__NR_statx, dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), (int)flags,
+                            (unsigned)mask, (void *)TO_HOST(addr)));
+}
+
+/// struct linux_dirent64 在各架构布局相同，直接转发
+static u64 sys_getdents64(machine_t *m) {
+    GET(a0, fd); GET(a1, bufptr); GET(a2, count);
+    return host_ret(syscall(__NR_getdents64, fd_host(m, fd), (void *)TO_HOST(bufptr), (unsigned)count));
+}
+
+// ============================================================================== //
+// 时间与进程信息
+// ============================================================================== //
+
 static u64 sys_gettimeofday(machine_t *m) {
     GET(a0, tv_addr); GET(a1, tz_addr);
-    struct timeval *tv = (struct timeval *)TO_HOST(tv_addr);
-    struct timezone *tz = NULL;
-    if (tz_addr != 0) tz = (struct timezone *)TO_HOST(tz_addr);
-    return gettimeofday(tv, tz);
+    return host_ret(gettimeofday((struct timeval *)TO_HOST(tv_addr), HOST_PTR(tz_addr)));
+}
+
+static u64 sys_clock_gettime(machine_t *m) {
+    GET(a0, clockid); GET(a1, tp_addr);
+    return host_ret(clock_gettime((clockid_t)clockid, (struct timespec *)TO_HOST(tp_addr)));
+}
+
+static u64 sys_clock_getres(machine_t *m) {
+    GET(a0, clockid); GET(a1, res_addr);
+    return host_ret(clock_getres((clockid_t)clockid, HOST_PTR(res_addr)));
+}
+
+static u64 sys_nanosleep(machine_t *m) {
+    GET(a0, req_addr); GET(a1, rem_addr);
+    syscall_flush(m);
+    return host_ret(nanosleep((struct timespec *)TO_HOST(req_addr), HOST_PTR(rem_addr)));
+}
+
+static u64 sys_time(machine_t *m) {
+    GET(a0, tloc);
+    return host_ret(time(HOST_PTR(tloc)));
 }
 
+static u64 sys_times(machine_t *m) {
+    GET(a0, addr);
+    return host_ret(syscall(__NR_times, HOST_PTR(addr)));
+}
+
+static u64 sys_getrusage(machine_t *m) {
+    GET(a0, who); GET(a1, addr);
+    return host_ret(getrusage(who, (struct rusage *)TO_HOST(addr)));
+}
+
+static u64 sys_sysinfo(machine_t *m) {
+    GET(a0, addr);
+    return host_ret(sysinfo((struct sysinfo *)TO_HOST(addr)));
+}
+
+/// 与主机相同，只把 machine 改为 riscv64
+static u64 sys_uname(machine_t *m) {
+    GET(a0, addr);
+    struct utsname *buf = (struct utsname *)TO_HOST(addr);
+    if (uname(buf) < 0) return host_ret(-1);
+    strcpy(buf->machine, "riscv64");
+    return 0;
+}
+
+static u64 sys_getpid(machine_t *m) { return getpid(); }
+static u64 sys_getppid(machine_t *m) { return getppid(); }
+static u64 sys_gettid(machine_t *m) { return syscall(__NR_gettid); }
+static u64 sys_getuid(machine_t *m) { return getuid(); }
+static u64 sys_geteuid(machine_t *m) { return geteuid(); }
+static u64 sys_getgid(machine_t *m) { return getgid(); }
+static u64 sys_getegid(machine_t *m) { return getegid(); }
+static u64 sys_sched_yield(machine_t *m) { return host_ret(sched_yield()); }
+
+/// 单线程：清除子线程 tid 的地址永远用不到
+static u64 sys_set_tid_address(machine_t *m) { return syscall(__NR_gettid); }
+static u64 sys_set_robust_list(machine_t *m) { return 0; }
+
+static u64 sys_getrandom(machine_t *m) {
+    GET(a0, bufptr); GET(a1, len); GET(a2, flags);
+    return host_ret(getrandom((void *)TO_HOST(bufptr), len, flags));
+}
+
+/// struct rlimit 是两个 64 位字段，布局相同
+static u64 sys_prlimit64(machine_t *m) {
+    GET(a0, pid); GET(a1, resource); GET(a2, new_addr); GET(a3, old_addr);
+    return host_ret(syscall(__NR_prlimit64, (int)pid, (int)resource,
+                            HOST_PTR(new_addr), HOST_PTR(old_addr)));
+}
+
+static u64 sys_getrlimit(machine_t *m) {
+    GET(a0, resource); GET(a1, addr);
+    return host_ret(getrlimit(resource, (struct rlimit *)TO_HOST(addr)));
+}
+
+static u64 sys_setrlimit(machine_t *m) {
+    GET(a0, resource); GET(a1, addr);
+    return host_ret(setrlimit(resource, (struct rlimit *)TO_HOST(addr)));
+}
+
+// ============================================================================== //
+// 信号：客户程序不能接收信号，只支持向自己发送信号（如 abort）
+// ============================================================================== //
+
+/// riscv64 内核的 struct sigaction：handler、flags、mask，没有 restorer
+#define GUEST_SIGACTION_SIZE 24
+
+static u64 sys_rt_sigaction(machine_t *m) {
+    GET(a2, old_addr);
+    if (old_addr) memset((void *)TO_HOST(old_addr), 0, GUEST_SIGACTION_SIZE);
+    return 0;
+}
+
+static u64 sys_rt_sigprocmask(machine_t *m) {
+    GET(a2, old_addr); GET(a3, sigsetsize);
+    if (old_addr) memset((void *)TO_HOST(old_addr), 0, sigsetsize);
+    return 0;
+}
+
+/// 信号编号与主机相同：先刷新输出，信号可能终止进程
+static u64 sys_kill(machine_t *m) {
+    GET(a0, pid); GET(a1, sig);
+    syscall_flush(m);
+    return host_ret(syscall(__NR_kill, (int)pid, (int)sig));
+}
+
+static u64 sys_tgkill(machine_t *m) {
+    GET(a0, tgid); GET(a1, tid); GET(a2, sig);
+    syscall_flush(m);
+    return host_ret(syscall(__NR_tgkill, (int)tgid, (int)tid, (int)sig));
+}
+
+// ============================================================================== //
+// 内存管理
+// ============================================================================== //
+
 /**
  * 申请/释放内存
  * malloc/free
  */
 static u64 sys_brk(machine_t *m) {
     GET(a0, addr);
-    if (addr == 0) addr = m->mmu.alloc;
-    assert(addr >= m->mmu.base);
+    // 与 Linux 一样：不能移动时返回原来的 break，不报错
+    if (addr < m->mmu.base) return m->mmu.alloc;
     i64 incr = (i64)addr - m->mmu.alloc;
-    mmu_alloc(&m->mmu, incr);
+    if (mmu_alloc(&m->mmu, incr) == 0) return m->mmu.alloc;
     return addr;
 }
 
-// the O_* macros is OS dependent.
-// here is a workaround to convert newlib flags to the host.
-#define NEWLIB_O_RDONLY   0x0
-#define NEWLIB_O_WRONLY   0x1
-#define NEWLIB_O_RDWR     0x2
-#define NEWLIB_O_APPEND   0x8
-#define NEWLIB_O_CREAT  0x200
-#define NEWLIB_O_TRUNC  0x400
-#define NEWLIB_O_EXCL   0x800
-#define REWRITE_FLAG(flag) if (flags & NEWLIB_ ##flag) hostflags |= flag;
+/// @brief 判断客户地址区间是否在 mmap 可用的范围内
+static bool mmap_range_ok(machine_t *m, u64 addr, u64 len) {
+    if (m->mmu.host_reserve == 0 || addr < m->mmu.base) return false;
+    u64 host_addr = TO_HOST(addr);
+    return host_addr <= m->mmu.host_reserve && len <= m->mmu.host_reserve - host_addr;
+}
+
+/// @brief 客户地址区间是否与 brk 堆区 [base, host_alloc) 重叠：堆区不能被 munmap 或 MAP_FIXED 覆盖
+static bool mmap_range_in_heap(machine_t *m, u64 addr, u64 len) {
+    u64 host_addr = TO_HOST(addr);
+    return host_addr < m->mmu.host_alloc && len > TO_HOST(m->mmu.base) - MIN(host_addr, TO_HOST(m->mmu.base));
+}
 
+/**
+ * ret = mmap(addr, len, prot, flags, fd, offset);
+ * MAP_* 与 PROT_* 的取值与主机相同，不区分客户程序的读写权限
+ */
+static u64 sys_mmap(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, prot); GET(a3, flags); GET(a4, fd); GET(a5, offset);
+    if (len == 0) return -EINVAL;
+
+    // 先检查 fd：出错时还没有占用地址空间
+    int host_prot = PROT_READ | PROT_WRITE, hfd = -1;
+    int host_flags = MAP_FIXED | (flags & (MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS));
+    if (!(flags & MAP_ANONYMOUS)) {
+        // 私有映射写时复制，总是可写；共享映射只在客户程序要求时可写，写回文件
+        if (flags & MAP_SHARED) host_prot = PROT_READ | (prot & PROT_WRITE);
+        fd_t *f = fd_get(m, fd);
+        if (!f) return -EBADF;
+        hfd = f->host;
+        if (f->vopen) {
+            // 直接映射缓存的 memfd：只读文件不能共享写入
+            if ((flags & MAP_SHARED) && (prot & PROT_WRITE)) return -EACCES;
+            hfd = f->vopen->file->memfd;
+        }
+        OUTBUF_SYNC(hfd);
+    }
+
+    if (!(flags & MAP_FIXED)) {
+        addr = mmu_mmap(&m->mmu, len);
+        if (addr == 0) return -ENOMEM;
+        if (flags & MAP_ANONYMOUS) return addr;
+    } else if (!mmap_range_ok(m, addr, len) || mmap_range_in_heap(m, addr, len)) {
+        return -ENOMEM;
+    }
+
+    void *ret = mmap((void *)TO_HOST(addr), len, host_prot, host_flags, hfd, offset);
+    if (ret == MAP_FAILED) {
+        int err = errno;
+        if (!(flags & MAP_FIXED)) mmu_munmap(&m->mmu, addr, len);
+        return -err;
+    }
+    if (flags & MAP_FIXED) mmu_mmap_fixed(&m->mmu, addr, len);
+    return addr;
+}
+
+static u64 sys_munmap(machine_t *m) {
+    GET(a0, addr); GET(a1, len);
+    if (len == 0 || (addr & (getpagesize() - 1)) || len > UINT64_MAX - TO_HOST(addr)) return -EINVAL;
+    if (m->mmu.host_reserve == 0) return 0;
+    if (mmap_range_in_heap(m, addr, len)) return -EINVAL;
+    // 只释放 mmap 区中的部分：与客户程序的映射不重叠时什么也不做
+    u64 start = MAX(TO_HOST(addr), m->mmu.host_alloc);
+    u64 end = MIN(TO_HOST(addr) + len, m->mmu.host_reserve);
+    if (start < end) mmu_munmap(&m->mmu, TO_GUEST(start), end - start);
+    return 0;
+}
+
+/// 不支持原地扩展：调用方会退回 mmap + 拷贝
+static u64 sys_mremap(machine_t *m) { return -ENOMEM; }
+
+/**
+ * 客户内存总是可读，除只读的共享文件映射外也总是可写：不收回权限。
+ * 要求可写时转给主机，只读打开的共享文件映射与 Linux 一样以 EACCES 失败
+ */
+static u64 sys_mprotect(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, prot);
+    if (!(prot & PROT_WRITE)) return 0;
+    u64 host_addr = TO_HOST(addr);
+    if (addr & (getpagesize() - 1) || host_addr > m->mmu.host_reserve ||
+        len > m->mmu.host_reserve - host_addr)
+        return -EINVAL;
+    // 堆区与 mmap 区之间没有提交的预留区：没有映射
+    if (host_addr < m->mmu.host_mmap && host_addr + len > m->mmu.host_alloc) return -ENOMEM;
+    return host_ret(mprotect((void *)host_addr, len, PROT_READ | PROT_WRITE));
+}
+
+/// 只有 MADV_DONTNEED 有可见的语义（之后读到 0），其余建议忽略
+static u64 sys_madvise(machine_t *m) {
+    GET(a0, addr); GET(a1, len); GET(a2, advice);
+    if (advice != MADV_DONTNEED) return 0;
+    if (!mmap_range_ok(m, addr, len)) return -EINVAL;
+    return host_ret(madvise((void *)TO_HOST(addr), len, MADV_DONTNEED));
+}
+
+// ============================================================================== //
+// 文件与目录
+// ============================================================================== //
+
+/// @brief 打开标志：客户程序按 Linux riscv64（asm-generic）取值，主机取值可能不同
+static const struct { int guest, host; } open_flags[] = {
+    {00000001, O_WRONLY},    {00000002, O_RDWR},     {00000100, O_CREAT},
+    {00000200, O_EXCL},      {00000400, O_NOCTTY},   {00001000, O_TRUNC},
+    {00002000, O_APPEND},    {00004000, O_NONBLOCK}, {00010000, O_DSYNC},
+    {00200000, O_DIRECTORY}, {00400000, O_NOFOLLOW}, {02000000, O_CLOEXEC},
+    {04010000, O_SYNC},      // 含 O_DSYNC 的位：整体匹配
+};
+
+/// @brief 客户程序的打开标志转换为主机标志：O_LARGEFILE 等没有对应的标志忽略
 static int convert_flags(int flags) {
     int hostflags = 0;
-    REWRITE_FLAG(O_RDONLY);
-    REWRITE_FLAG(O_WRONLY);
-    REWRITE_FLAG(O_RDWR);
-    REWRITE_FLAG(O_APPEND);
-    REWRITE_FLAG(O_CREAT);
-    REWRITE_FLAG(O_TRUNC);
-    REWRITE_FLAG(O_EXCL);
+    for (u64 i = 0; i < ARRAY_SIZE(open_flags); i++)
+        if ((flags & open_flags[i].guest) == open_flags[i].guest) hostflags |= open_flags[i].host;
     return hostflags;
 }
 
+/// @brief 主机的打开标志转换为客户程序的标志：F_GETFL 返回
+static int convert_flags_back(int hostflags) {
+    int flags = 0;
+    for (u64 i = 0; i < ARRAY_SIZE(open_flags); i++)
+        if ((hostflags & open_flags[i].host) == open_flags[i].host) flags |= open_flags[i].guest;
+    return flags;
+}
+
+/// @brief 只读打开先查 vfs 缓存；其他打开方式由主机打开，并使同一文件的缓存失效
+static u64 vfs_try_open(machine_t *m, const char *name, int flags, mode_t mode) {
+    int hostflags = convert_flags(flags);
+    bool rdonly = (hostflags & (O_ACCMODE | O_CREAT | O_TRUNC)) == O_RDONLY;
+    vopen_t *vo = rdonly ? vfs_open(name) : NULL;
+    if (vo) {
+        fd_t *f = fd_alloc(m, FD_VFS, 0);
+        if (!f) {
+            vfs_close(vo);
+            return -EMFILE;
+        }
+        f->vopen = vo;
+        return f - m->fdt.fds;
+    }
+
+    u64 ret = fd_install(m, open(name, hostflags, mode), 0);
+    if (!rdonly && (i64)ret >= 0) fd_written(m, &m->fdt.fds[ret]);
+    return ret;
+}
+
 static u64 sys_openat(machine_t *m) {
     GET(a0, dirfd); GET(a1, nameptr); GET(a2, flags); GET(a3, mode);
-    return openat(dirfd, (char *)TO_HOST(nameptr), convert_flags(flags), mode);
+    char *name = (char *)TO_HOST(nameptr);
+    outbuf_sync_files(m);
+    if (SYSCALL_VFS && ((int)dirfd == AT_FDCWD || name[0] == '/'))
+        return vfs_try_open(m, name, flags, mode);
+    int host = openat(dirfd_host(m, dirfd), name, convert_flags(flags), mode);
+    return fd_install(m, host, 0);
 }
 
 static u64 sys_open(machine_t *m) {
     GET(a0, nameptr); GET(a1, flags); GET(a2, mode);
-    u64 ret = open((char *)TO_HOST(nameptr), convert_flags(flags), (mode_t)mode);
-    return ret;
+    char *name = (char *)TO_HOST(nameptr);
+    outbuf_sync_files(m);
+    if (SYSCALL_VFS) return vfs_try_open(m, name, flags, mode);
+    int host = open(name, convert_flags(flags), (mode_t)mode);
+    return fd_install(m, host, 0);
 }
 
 static u64 sys_lseek(machine_t *m) {
     GET(a0, fd); GET(a1, offset); GET(a2, whence);
-    return lseek(fd, offset, whence);
+    fd_t *f = fd_get(m, fd);
+    if (f && f->vopen) return vfs_lseek(f->vopen, offset, whence);
+    return host_ret(lseek(fd_host(m, fd), offset, whence));
 }
 
 static u64 sys_read(machine_t *m) {
     GET(a0, fd); GET(a1, bufptr); GET(a2, count);
-    return read(fd, (char *)TO_HOST(bufptr), (size_t)count);
+    fd_t *f = fd_get(m, fd);
+    if (f && f->vopen) return vfs_read(f->vopen, (char *)TO_HOST(bufptr), count);
+    int hfd = fd_host(m, fd);
+    OUTBUF_SYNC(hfd);
+    return host_ret(read(hfd, (char *)TO_HOST(bufptr), (size_t)count));
+}
+
+static u64 sys_pread(machine_t *m) {
+    GET(a0, fd); GET(a1, bufptr); GET(a2, count); GET(a3, offset);
+    fd_t *f = fd_get(m, fd);
+    if (f && f->vopen) {
+        if ((i64)offset < 0) return -EINVAL;
+        return vfs_pread(f->vopen, (char *)TO_HOST(bufptr), count, offset);
+    }
+    int hfd = fd_host(m, fd);
+    OUTBUF_SYNC(hfd);
+    return host_ret(pread(hfd, (char *)TO_HOST(bufptr), (size_t)count, (off_t)offset));
+}
+
+static u64 sys_pwrite(machine_t *m) {
+    GET(a0, fd); GET(a1, bufptr); GET(a2, count); GET(a3, offset);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    OUTBUF_SYNC(f->host);
+    fd_written(m, f);
+    return host_ret(pwrite(f->host, (char *)TO_HOST(bufptr), (size_t)count, (off_t)offset));
+}
+
+/// 一次向量 I/O 最多的 iovec 个数：与 Linux 的 UIO_MAXIOV 相同
+#define SYS_IOV_MAX 1024
+
+/**
+ * 客户 iovec 与主机 struct iovec 布局相同（两个 64 位字段），
+ * 只需把 iov_base 转换成主机地址，数据本身不拷贝
+ */
+static int iov_to_host(struct iovec *iov, u64 iovptr, u64 iovcnt) {
+    if (iovcnt > SYS_IOV_MAX) return -1;
+    struct iovec *guest_iov = (struct iovec *)TO_HOST(iovptr);
+    for (u64 i = 0; i < iovcnt; i++) {
+        iov[i].iov_base = (void *)TO_HOST((u64)guest_iov[i].iov_base);
+        iov[i].iov_len = guest_iov[i].iov_len;
+    }
+    return iovcnt;
 }
 
+/**
+ * 向量读写：
+ * ret = readv(fd, iov, iovcnt);
+ * ret = writev(fd, iov, iovcnt);
+ */
+static u64 sys_readv(machine_t *m) {
+    GET(a0, fd); GET(a1, iovptr); GET(a2, iovcnt);
+    int hfd = fd_host(m, fd);
+    OUTBUF_SYNC(hfd);
+    struct iovec iov[SYS_IOV_MAX];
+    int n = iov_to_host(iov, iovptr, iovcnt);
+    if (n < 0) return -EINVAL;
+    fd_t *f = fd_get(m, fd);
+    if (f && f->vopen) {
+        i64 total = 0;
+        for (int i = 0; i < n; i++) total += vfs_read(f->vopen, iov[i].iov_base, iov[i].iov_len);
+        return total;
+    }
+    return host_ret(readv(hfd, iov, n));
+}
+
+static u64 sys_writev(machine_t *m) {
+    GET(a0, fd); GET(a1, iovptr); GET(a2, iovcnt);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    OUTBUF_SYNC(f->host);
+    struct iovec iov[SYS_IOV_MAX];
+    int n = iov_to_host(iov, iovptr, iovcnt);
+    if (n < 0) return -EINVAL;
+    fd_written(m, f);
+    return host_ret(writev(f->host, iov, n));
+}
+
+static u64 sys_dup(machine_t *m) {
+    GET(a0, fd);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    return fd_dup(m, f, 0, false);
+}
+
+static u64 sys_dup3(machine_t *m) {
+    GET(a0, oldfd); GET(a1, newfd); GET(a2, flags);
+    fd_t *f = fd_get(m, oldfd);
+    if (!f || newfd >= SYSCALL_FD_MAX) return -EBADF;
+    if (oldfd == newfd) return -EINVAL;
+    // newfd 是释放后最小的空闲 fd
+    fd_t *g = fd_get(m, newfd);
+    if (g) fd_release(m, g);
+    return fd_dup(m, f, newfd, flags & O_CLOEXEC);
+}
+
+/**
+ * ret = fcntl(fd, cmd, arg);
+ * F_* 的取值与 struct flock 的布局与主机相同，锁操作的参数是指针
+ */
+static u64 sys_fcntl(machine_t *m) {
+    GET(a0, fd); GET(a1, cmd); GET(a2, arg);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    if (f->vopen && cmd != F_DUPFD && cmd != F_DUPFD_CLOEXEC)
+        return cmd == F_GETFL ? O_RDONLY : 0;
+    switch (cmd) {
+    case F_DUPFD: case F_DUPFD_CLOEXEC:
+        // 客户 fd 的最小值由客户 fd 表决定
+        return fd_dup(m, f, arg, cmd == F_DUPFD_CLOEXEC);
+    case F_GETLK: case F_SETLK: case F_SETLKW:
+        return host_ret(fcntl(f->host, cmd, (struct flock *)TO_HOST(arg)));
+    case F_GETFL: {
+        int flags = fcntl(f->host, cmd);
+        return flags < 0 ? host_ret(flags) : (u64)convert_flags_back(flags);
+    }
+    case F_SETFL:
+        f->kind = 0;    // O_APPEND 可能改变
+        return host_ret(fcntl(f->host, cmd, convert_flags(arg)));
+    default:
+        return host_ret(fcntl(f->host, cmd, arg));
+    }
+}
+
+/// 只支持终端查询：isatty 与窗口大小，其他请求按非终端处理
+static u64 sys_ioctl(machine_t *m) {
+    GET(a0, fd); GET(a1, req); GET(a2, arg);
+    if (req != TCGETS && req != TIOCGWINSZ) return -ENOTTY;
+    return host_ret(ioctl(fd_host(m, fd), req, (void *)TO_HOST(arg)));
+}
+
+static u64 sys_ftruncate(machine_t *m) {
+    GET(a0, fd); GET(a1, len);
+    fd_t *f = fd_get(m, fd);
+    if (!f) return -EBADF;
+    fd_written(m, f);
+    return host_ret(ftruncate(f->host, len));
+}
+
+static u64 sys_fsync(machine_t *m) {
+    GET(a0, fd);
+    int hfd = fd_host(m, fd);
+    OUTBUF_SYNC(hfd);
+    return host_ret(fsync(hfd));
+}
+
+/// 内核的 getcwd 返回包含结尾 0 的长度
+static u64 sys_getcwd(machine_t *m) {
+    GET(a0, bufptr); GET(a1, size);
+    char *buf = (char *)TO_HOST(bufptr);
+    if (getcwd(buf, size) == NULL) return host_ret(-1);
+    return strlen(buf) + 1;
+}
+
+static u64 sys_chdir(machine_t *m) {
+    GET(a0, nameptr);
+    if (SYSCALL_VFS) vfs_chdir();
+    return host_ret(chdir((char *)TO_HOST(nameptr)));
+}
+
+static u64 sys_faccessat(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, mode);
+    return host_ret(faccessat(dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), mode, 0));
+}
+
+static u64 sys_access(machine_t *m) {
+    GET(a0, nameptr); GET(a1, mode);
+    return host_ret(access((char *)TO_HOST(nameptr), mode));
+}
+
+static u64 sys_readlinkat(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, bufptr); GET(a3, size);
+    return host_ret(readlinkat(dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), (char *)TO_HOST(bufptr), size));
+}
+
+static u64 sys_mkdirat(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, mode);
+    return host_ret(mkdirat(dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), mode));
+}
+
+static u64 sys_mkdir(machine_t *m) {
+    GET(a0, nameptr); GET(a1, mode);
+    return host_ret(mkdir((char *)TO_HOST(nameptr), mode));
+}
+
+/// @brief 路径上的文件将被删除或替换：丢弃 vfs 中同一文件的缓存
+static void vfs_forget(machine_t *m, u64 dirfd, const char *name) {
+    struct stat st;
+    if (SYSCALL_VFS && fstatat(dirfd_host(m, dirfd), name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        vfs_invalidate_inode(st.st_dev, st.st_ino);
+}
+
+static u64 sys_unlinkat(machine_t *m) {
+    GET(a0, dirfd); GET(a1, nameptr); GET(a2, flags);
+    vfs_forget(m, dirfd, (char *)TO_HOST(nameptr));
+    return host_ret(unlinkat(dirfd_host(m, dirfd), (char *)TO_HOST(nameptr), flags));
+}
+
+static u64 sys_unlink(machine_t *m) {
+    GET(a0, nameptr);
+    vfs_forget(m, AT_FDCWD, (char *)TO_HOST(nameptr));
+    return host_ret(unlink((char *)TO_HOST(nameptr)));
+}
+
+static u64 sys_linkat(machine_t *m) {
+    GET(a0, olddirfd); GET(a1, oldptr); GET(a2, newdirfd); GET(a3, newptr); GET(a4, flags);
+    return host_ret(linkat(dirfd_host(m, olddirfd), (char *)TO_HOST(oldptr),
+                           dirfd_host(m, newdirfd), (char *)TO_HOST(newptr), flags));
+}
+
+static u64 sys_link(machine_t *m) {
+    GET(a0, oldptr); GET(a1, newptr);
+    return host_ret(link((char *)TO_HOST(oldptr), (char *)TO_HOST(newptr)));
+}
+
+static u64 sys_renameat(machine_t *m) {
+    GET(a0, olddirfd); GET(a1, oldptr); GET(a2, newdirfd); GET(a3, newptr);
+    vfs_forget(m, olddirfd, (char *)TO_HOST(oldptr));
+    vfs_forget(m, newdirfd, (char *)TO_HOST(newptr));
+    return host_ret(renameat(dirfd_host(m, olddirfd), (char *)TO_HOST(oldptr),
+                             dirfd_host(m, newdirfd), (char *)TO_HOST(newptr)));
+}
+
+static u64 sys_renameat2(machine_t *m) {
+    GET(a0, olddirfd); GET(a1, oldptr); GET(a2, newdirfd); GET(a3, newptr); GET(a4, flags);
+    vfs_forget(m, olddirfd, (char *)TO_HOST(oldptr));
+    vfs_forget(m, newdirfd, (char *)TO_HOST(newptr));
+    return host_ret(syscall(__NR_renameat2, dirfd_host(m, olddirfd), (char *)TO_HOST(oldptr),
+                            dirfd_host(m, newdirfd), (char *)TO_HOST(newptr), (unsigned)flags));
+}
+
+#define SYSCALL(name, func) [SYS_ ## name] = { func, #name }
+#define OLD_SYSCALL(name, func) [SYS_ ## name - OLD_SYSCALL_THRESHOLD] = { func, #name }
+
 /// @brief 系统调用映射表
-static syscall_t syscall_table[] = {
-    [SYS_exit] =           sys_exit,
-    [SYS_exit_group] =     sys_exit,
-    [SYS_read] =           sys_read,
-    [SYS_pread] =          sys_unimplemented,
-    [SYS_write] =          sys_write,
-    [SYS_openat] =         sys_openat,
-    [SYS_close] =          sys_close,
-    [SYS_fstat] =          sys_fstat,
-    [SYS_statx] =          sys_unimplemented,
-    [SYS_lseek] =          sys_lseek,
-    [SYS_fstatat] =        sys_unimplemented,
-    [SYS_linkat] =         sys_unimplemented,
-    [SYS_unlinkat] =       sys_unimplemented,
-    [SYS_mkdirat] =        sys_unimplemented,
-    [SYS_renameat] =       sys_unimplemented,
-    [SYS_getcwd] =         sys_unimplemented,
-    [SYS_brk] =            sys_brk,
-    [SYS_uname] =          sys_unimplemented,
-    [SYS_getpid] =         sys_unimplemented,
-    [SYS_getuid] =         sys_unimplemented,
-    [SYS_geteuid] =        sys_unimplemented,
-    [SYS_getgid] =         sys_unimplemented,
-    [SYS_getegid] =        sys_unimplemented,
-    [SYS_gettid] =         sys_unimplemented,
-    [SYS_tgkill] =         sys_unimplemented,
-    [SYS_mmap] =           sys_unimplemented,
-    [SYS_munmap] =         sys_unimplemented,
-    [SYS_mremap] =         sys_unimplemented,
-    [SYS_mprotect] =       sys_unimplemented,
-    [SYS_rt_sigaction] =   sys_unimplemented,
-    [SYS_gettimeofday] =   sys_gettimeofday,
-    [SYS_times] =          sys_unimplemented,
-    [SYS_writev] =         sys_unimplemented,
-    [SYS_faccessat] =      sys_unimplemented,
-    [SYS_fcntl] =          sys_unimplemented,
-    [SYS_ftruncate] =      sys_unimplemented,
-    [SYS_getdents] =       sys_unimplemented,
-    [SYS_dup] =            sys_unimplemented,
-    [SYS_dup3] =           sys_unimplemented,
-    [SYS_rt_sigprocmask] = sys_unimplemented,
-    [SYS_clock_gettime] =  sys_unimplemented,
-    [SYS_chdir] =          sys_unimplemented,
+static syscall_entry_t syscall_table[] = {
+    SYSCALL(getcwd,             sys_getcwd),
+    SYSCALL(dup,                sys_dup),
+    SYSCALL(dup3,               sys_dup3),
+    SYSCALL(fcntl,              sys_fcntl),
+    SYSCALL(ioctl,              sys_ioctl),
+    SYSCALL(mkdirat,            sys_mkdirat),
+    SYSCALL(unlinkat,           sys_unlinkat),
+    SYSCALL(linkat,             sys_linkat),
+    SYSCALL(renameat,           sys_renameat),
+    SYSCALL(ftruncate,          sys_ftruncate),
+    SYSCALL(faccessat,          sys_faccessat),
+    SYSCALL(chdir,              sys_chdir),
+    SYSCALL(openat,             sys_openat),
+    SYSCALL(close,              sys_close),
+    SYSCALL(getdents64,         sys_getdents64),
+    SYSCALL(lseek,              sys_lseek),
+    SYSCALL(read,               sys_read),
+    SYSCALL(write,              sys_write),
+    SYSCALL(readv,              sys_readv),
+    SYSCALL(writev,             sys_writev),
+    SYSCALL(pread,              sys_pread),
+    SYSCALL(pwrite,             sys_pwrite),
+    SYSCALL(readlinkat,         sys_readlinkat),
+    SYSCALL(fstatat,            sys_fstatat),
+    SYSCALL(fstat,              sys_fstat),
+    SYSCALL(fsync,              sys_fsync),
+    SYSCALL(exit,               sys_exit),
+    SYSCALL(exit_group,         sys_exit),
+    SYSCALL(set_tid_address,    sys_set_tid_address),
+    SYSCALL(set_robust_list,    sys_set_robust_list),
+    SYSCALL(nanosleep,          sys_nanosleep),
+    SYSCALL(clock_gettime,      sys_clock_gettime),
+    SYSCALL(clock_getres,       sys_clock_getres),
+    SYSCALL(sched_yield,        sys_sched_yield),
+    SYSCALL(kill,               sys_kill),
+    SYSCALL(tgkill,             sys_tgkill),
+    SYSCALL(rt_sigaction,       sys_rt_sigaction),
+    SYSCALL(rt_sigprocmask,     sys_rt_sigprocmask),
+    SYSCALL(times,              sys_times),
+    SYSCALL(uname,              sys_uname),
+    SYSCALL(getrlimit,          sys_getrlimit),
+    SYSCALL(setrlimit,          sys_setrlimit),
+    SYSCALL(getrusage,          sys_getrusage),
+    SYSCALL(gettimeofday,       sys_gettimeofday),
+    SYSCALL(getpid,             sys_getpid),
+    SYSCALL(getppid,            sys_getppid),
+    SYSCALL(getuid,             sys_getuid),
+    SYSCALL(geteuid,            sys_geteuid),
+    SYSCALL(getgid,             sys_getgid),
+    SYSCALL(getegid,            sys_getegid),
+    SYSCALL(gettid,             sys_gettid),
+    SYSCALL(sysinfo,            sys_sysinfo),
+    SYSCALL(brk,                sys_brk),
+    SYSCALL(munmap,             sys_munmap),
+    SYSCALL(mremap,             sys_mremap),
+    SYSCALL(mmap,               sys_mmap),
+    SYSCALL(mprotect,           sys_mprotect),
+    SYSCALL(madvise,            sys_madvise),
+    SYSCALL(prlimit64,          sys_prlimit64),
+    SYSCALL(renameat2,          sys_renameat2),
+    SYSCALL(getrandom,          sys_getrandom),
+    SYSCALL(statx,              sys_statx),
 };
 
 /// @brief 旧系统调用表
-static syscall_t old_syscall_table[] = {
-    [-OLD_SYSCALL_THRESHOLD + SYS_open] =   sys_open,
-    [-OLD_SYSCALL_THRESHOLD + SYS_link] =   sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_unlink] = sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_mkdir] =  sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_access] = sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_stat] =   sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_lstat] =  sys_unimplemented,
-    [-OLD_SYSCALL_THRESHOLD + SYS_time] =   sys_unimplemented,
+static syscall_entry_t old_syscall_table[] = {
+    OLD_SYSCALL(open,   sys_open),
+    OLD_SYSCALL(link,   sys_link),
+    OLD_SYSCALL(unlink, sys_unlink),
+    OLD_SYSCALL(mkdir,  sys_mkdir),
+    OLD_SYSCALL(access, sys_access),
+    OLD_SYSCALL(stat,   sys_stat),
+    OLD_SYSCALL(lstat,  sys_lstat),
+    OLD_SYSCALL(time,   sys_time),
 };
 
+_Static_assert(offsetof(machine_t, state) == 0, "state must be the first member of machine_t");
+
+u64 syscall_trampoline(void *state) {
+    machine_t *m = (machine_t *)state;
+    fenv_leave(&m->state);
+    u64 ret = do_syscall(m, machine_get_gp_reg(m, a7));
+    fenv_enter(&m->state);
+    return ret;
+}
+
+/// @brief 主机单调时钟：纳秒
+static inline u64 host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/// @brief 快速路径的计数：与 do_syscall 一样计入系统调用表
+static inline void fast_path_count(u64 n, u64 start) {
+    syscall_table[n].count++;
+    syscall_table[n].ns += host_ns() - start;
+}
+
+int syscall_clock_gettime(int clockid, void *tp) {
+    u64 start = TEMU_STATS ? host_ns() : 0;
+    int ret = host_ret(clock_gettime((clockid_t)clockid, tp));
+    if (TEMU_STATS) fast_path_count(SYS_clock_gettime, start);
+    return ret;
+}
+
+int syscall_gettimeofday(void *tv, void *tz) {
+    u64 start = TEMU_STATS ? host_ns() : 0;
+    int ret = host_ret(gettimeofday(tv, tz));
+    if (TEMU_STATS) fast_path_count(SYS_gettimeofday, start);
+    return ret;
+}
+
 u64 do_syscall(machine_t *m, u64 n) {
-    syscall_t f = NULL;
+    syscall_entry_t *e = NULL;
     if (n < ARRAY_SIZE(syscall_table))
-        f = syscall_table[n];
+        e = &syscall_table[n];
     else if (n - OLD_SYSCALL_THRESHOLD < ARRAY_SIZE(old_syscall_table))
-        f = old_syscall_table[n - OLD_SYSCALL_THRESHOLD];
+        e = &old_syscall_table[n - OLD_SYSCALL_THRESHOLD];
 
-    if (!f) fatal("unknown syscall");
+    if (!e || !e->func) fatalf("unknown syscall: %lu", n);
 
-    return f(m);
-}
\ No newline at end of file
+    // 连续的写入可以一起在途，其他系统调用可能依赖写入结果
+    if (SYSCALL_URING && n != SYS_write) afile_drain(m);
+
+    if (!TEMU_STATS) return e->func(m);
+
+    // 先计数：exit 不会返回
+    e->count++;
+    u64 start = host_ns();
+    u64 ret = e->func(m);
+    e->ns += host_ns() - start;
+    return ret;
+}
+
+/// @brief 按累计耗时从大到小排序
+static int syscall_entry_cmp(const void *a, const void *b) {
+    const syscall_entry_t *x = *(syscall_entry_t **)a, *y = *(syscall_entry_t **)b;
+    if (x->ns != y->ns) return x->ns < y->ns ? 1 : -1;
+    return x->count < y->count ? 1 : (x->count > y->count ? -1 : 0);
+}
+
+void syscall_report(void) {
+    syscall_entry_t *used[ARRAY_SIZE(syscall_table) + ARRAY_SIZE(old_syscall_table)];
+    u64 n = 0;
+    for (u64 i = 0; i < ARRAY_SIZE(syscall_table); i++)
+        if (syscall_table[i].count) used[n++] = &syscall_table[i];
+    for (u64 i = 0; i < ARRAY_SIZE(old_syscall_table); i++)
+        if (old_syscall_table[i].count) used[n++] = &old_syscall_table[i];
+    qsort(used, n, sizeof(used[0]), syscall_entry_cmp);
+
+    for (u64 i = 0; i < n; i++)
+        fprintf(stderr, "syscall: %-16s %10lu calls %12.3f ms\n",
+                used[i]->name, used[i]->count, used[i]->ns / 1e6);
+}
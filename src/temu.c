@@ -3,16 +3,48 @@
  * \brief temu 主程序入口
  */
 
+#define stack_t host_stack_t     // 主机的 stack_t 与 temu.h 中的同名
+#include <signal.h>
+#undef stack_t
 #include "temu.h"
 
+static machine_t machine = {0};
+
+/// @brief 退出时刷新输出缓冲，输出运行统计
+static void temu_exit(void)
+{
+    syscall_flush(&machine);
+    if (TEMU_STATS) {
+        mmu_report(&machine.mmu);
+        cache_report(machine.cache);
+        syscall_report();
+        ir_report();
+        emit_report();
+        llvm_report();
+    }
+}
+
+/// @brief 主机崩溃时先写出缓冲的输出，再以原信号终止
+static void temu_crash(int sig)
+{
+    syscall_flush(&machine);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
 int main(int argc, char *argv[])
 {
     assert(argc > 1);
 
-    machine_t machine = {0};
+    interp_init();                              // 按主机 CPU 选择解释器的实现
     machine.cache = new_cache();                // 初始化cache
     machine_load_program(&machine, argv[1]);    // 加载可执行文件
     machine_setup(&machine, argc, argv);        // 虚拟机初始化
+    atexit(temu_exit);
+    if (SYSCALL_OUTBUF) {
+        int sigs[] = {SIGSEGV, SIGBUS, SIGABRT, SIGFPE, SIGILL};
+        for (u64 i = 0; i < ARRAY_SIZE(sigs); i++) signal(sigs[i], temu_crash);
+    }
 
     while(true) {
         // 执行指令
@@ -5,12 +5,16 @@
 #include <math.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "types.h"
@@ -32,6 +36,11 @@
 /// 数组大小
 #define ARRAY_SIZE(x)   (sizeof(x)/sizeof((x)[0]))
 
+/// 运行统计：编译时加 `-DTEMU_STATS=1`，退出时输出到 stderr
+#ifndef TEMU_STATS
+#define TEMU_STATS 0
+#endif
+
 #define fatalf(fmt, ...) (fprintf(stderr, "fatal: %s:%d " fmt "\n", __FILE__, __LINE__, __VA_ARGS__), exit(1))
 /// fatal 宏：输出错误信息
 #define fatal(msg) fatalf("%s", msg)
@@ -56,7 +65,9 @@ enum insn_type_t {
     insn_sub, insn_sra, insn_lui,
     insn_addw, insn_sllw, insn_srlw, insn_mulw, insn_divw, insn_divuw, insn_remw, insn_remuw, insn_subw, insn_sraw,
     insn_beq, insn_bne, insn_blt, insn_bge, insn_bltu, insn_bgeu,
-    insn_jalr, insn_jal, insn_ecall,
+    insn_jalr, insn_jal,
+    insn_zext, insn_ld_pc,  // 融合指令：由 insn_fuse 把两条指令合成一条
+    insn_ecall,
     insn_csrrc, insn_csrrci, insn_csrrs, insn_csrrsi, insn_csrrw, insn_csrrwi,
     insn_flw, insn_fsw,
     insn_fmadd_s, insn_fmsub_s, insn_fnmsub_s, insn_fnmadd_s, insn_fadd_s, insn_fsub_s, insn_fmul_s, insn_fdiv_s, insn_fsqrt_s,
@@ -90,13 +101,32 @@ typedef struct {
     enum insn_type_t type;  // 指令类型
     bool rvc;   // 是否 rvc 压缩指令
     bool cont;  // 是否继续执行
+    u8 len;     // 指令长度：2 或 4，融合指令为两条之和
 } insn_t;
 
+/// 宏融合：解码时把常见的指令对合成一条，编译时加 `-DINSN_FUSE=0` 关闭
+#ifndef INSN_FUSE
+#define INSN_FUSE 1
+#endif
+
 /// @brief 解码指令
 /// @param insn 指令
 /// @param data 数据
 void insn_decode(insn_t *insn, u32 data);
 
+/**
+ * @brief 宏融合：insn 与紧接着的下一条指令合成一条，中间结果被覆盖时才融合
+ *     lui + addi/addiw   -> lui     常量
+ *     auipc + addi       -> auipc   地址
+ *     auipc + jalr       -> jal     远调用，变成可以串联的直接跳转
+ *     auipc + ld         -> ld_pc   GOT 表项
+ *     slli + srli        -> zext    零扩展
+ * @param insn 已解码的指令
+ * @param next_data 下一条指令的主机地址：只在可能融合时读取
+ * @return 是否融合
+ */
+bool insn_fuse(insn_t *insn, const u16 *next_data);
+
 
 // ============================================================================== //
 // 栈 stack => stack.c
@@ -208,16 +238,43 @@ void set_reset(set_t *set);
 // 内存 mmu
 // ============================================================================== //
 
+/// 内存填充策略：0 懒惰填充（缺页时分配），1 预先填充（`MAP_POPULATE`）
+#ifndef MMU_POPULATE
+#define MMU_POPULATE 0
+#endif
+/// 匿名映射不小于该值时提示内核使用透明大页（`MADV_HUGEPAGE`）
+#define MMU_HUGEPAGE_THRESHOLD (2 * 1024 * 1024)
+/// 堆区预留大小：一次性映射为 `PROT_NONE`，按需提交
+#define MMU_HEAP_RESERVE       (16ULL * 1024 * 1024 * 1024)
+/// 堆区提交粒度
+#define MMU_COMMIT_CHUNK       (2 * 1024 * 1024)
+/// 堆区收缩时空闲内存超过该值才归还给系统
+#define MMU_RELEASE_THRESHOLD  (16 * 1024 * 1024)
+/// mmap 区中释放后留下的空洞最多记录的个数：超出时不再记录，这部分空间不再复用
+#define MMU_MAX_HOLES          256
+
+/// @brief mmap 区中的空洞：主机地址 [start, end)
+typedef struct {
+    u64 start;
+    u64 end;
+} mmu_hole_t;
+
 /// @brief 内存信息结构体
 typedef struct {
     u64 entry;          // 入口地址
-    u64 host_alloc;     // 程序内存分割值：最大segament
+    u64 host_alloc;     // 已提交内存的结束地址：加载后为最大 segment 的结束地址
     u64 alloc;          // 申请内存地址
     u64 base;           //
-
-    //              | host_alloc
-    // [   `ELF`    |    `malloc`   |  ... ]
-    //              | base          |alloc
+    u64 host_reserve;   // 堆区预留的结束地址
+    u64 host_mmap;      // mmap 区域的起始地址：从预留区顶部向下分配
+    u64 host_dirty;     // 客户程序用过的内存结束地址：之上的已提交内存全为 0
+    long minflt;        // 加载前的次缺页数：用于统计
+    long majflt;        // 加载前的主缺页数
+    u64 nholes;         // 空洞个数
+    mmu_hole_t holes[MMU_MAX_HOLES];    // mmap 区中的空洞：按地址排序，互不相邻
+
+    //              | base        | alloc       | host_alloc    | host_mmap   | host_reserve
+    // [   `ELF`    |   `malloc`  |  committed  |  PROT_NONE  |   `mmap`    ]
 } mmu_t;
 
 /// @brief 将文件读入内存
@@ -228,9 +285,31 @@ void mmu_load_elf(mmu_t *mmu, int fd);
 /// @brief 内存申请
 /// @param mmu 内存对象
 /// @param sz 申请大小
-/// @return base地址
+/// @return base地址：0 表示空间不足，break 不变
 u64 mmu_alloc(mmu_t *mmu, i64 sz);
 
+/// @brief 为客户程序的 mmap 分配内存：从预留区顶部向下分配，内容全为 0
+/// @param mmu 内存对象
+/// @param len 长度
+/// @return 客户地址：0 表示空间不足
+u64 mmu_mmap(mmu_t *mmu, u64 len);
+
+/// @brief 释放 mmap 分配的内存：留下的空洞供之后的 mmap 复用
+/// @param mmu 内存对象
+/// @param addr 客户地址：不低于 host_alloc
+/// @param len 长度
+void mmu_munmap(mmu_t *mmu, u64 addr, u64 len);
+
+/// @brief 记录客户程序 MAP_FIXED 映射的区间：之后的 mmap 与 brk 都不会再用到它
+/// @param mmu 内存对象
+/// @param addr 客户地址：不低于 host_alloc
+/// @param len 长度
+void mmu_mmap_fixed(mmu_t *mmu, u64 addr, u64 len);
+
+/// @brief 输出加载以来的缺页次数
+/// @param mmu 内存对象
+void mmu_report(mmu_t *mmu);
+
 
 /// @brief 将长度为 len 的 data 数据存入指定内存地址 addr
 /// @param addr 地址
@@ -249,6 +328,24 @@ inline void mmu_write(u64 addr, u8 *data, size_t len) {
 /// 高速缓存大小：64MB
 #define CACHE_SIZE       (64 * 1024 * 1024)
 
+/// 是否把冷代码放进单独的冷区：很少走的跳转一边、跳出到解释器的出口、只读数据等，热代码排得更紧
+#ifndef CACHE_SPLIT
+#define CACHE_SPLIT 1
+#endif
+/// 冷区大小：在高速缓存的末尾
+#define CACHE_COLD_SIZE  (CACHE_SIZE / 4)
+
+/// 高速缓存提示内核使用透明大页（`MADV_HUGEPAGE`），减少 iTLB 缺失
+#ifndef CACHE_HUGEPAGE
+#define CACHE_HUGEPAGE 1
+#endif
+/// 高速缓存先试 hugetlbfs 大页：每个进程占用系统预留池中的 CACHE_SIZE / 2MB 个大页，默认关闭
+#ifndef CACHE_HUGETLB
+#define CACHE_HUGETLB 0
+#endif
+/// 大页大小：高速缓存按它对齐
+#define CACHE_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
 /// @brief 高速缓存表项
 typedef struct {
     u64 pc;         // 指令计数器  key
@@ -258,8 +355,12 @@ typedef struct {
 
 /// @brief 高速缓存结构体
 typedef struct {
-    u8 *jitcode;    // 可执行内存指针
+    u8 *jitcode;    // 可执行内存指针：只读可执行视图
+    u8 *jitcode_rw; // 同一段内存的可写视图：W^X，不可用时与 jitcode 相同
     u64 offset;     // JIT code 使用地址：不回收
+    u64 cold;       // 冷区使用地址：从 CACHE_SIZE - CACHE_COLD_SIZE 开始，不回收
+    const char *pages;  // 实际使用的页：hugetlb、thp 或 4k
+    int itlb_fd;        // iTLB 缺失计数器：TEMU_STATS 时打开，打不开时为 -1
     cache_item_t table[CACHE_ENTRY_SIZE];   // 高速缓存表：哈希表
 } cache_t;
 
@@ -267,12 +368,41 @@ typedef struct {
 /// @return 高速缓存对象
 cache_t *new_cache();
 
+/// @brief 输出高速缓存使用的页与 iTLB 缺失次数：TEMU_STATS 时在退出时调用
+/// @param cache 高速缓存对象
+void cache_report(cache_t *cache);
+
 /// @brief 在 cache 中寻找与 pc 相匹配的代码块
 /// @param cache 高速缓存对象
 /// @param pc 程序计数器
 /// @return 可执行内存地址
 u8 *cache_lookup(cache_t *cache, u64 pc);
 
+/// @brief 可执行内存地址对应的可写地址：其他地址原样返回
+/// @param cache 高速缓存对象
+/// @param addr 地址
+/// @return 可以写入的地址
+inline u8 *cache_rw(cache_t *cache, u8 *addr) {
+    if (addr < cache->jitcode || addr >= cache->jitcode + CACHE_SIZE) return addr;
+    return cache->jitcode_rw + (addr - cache->jitcode);
+}
+
+/// @brief 在可执行内存中分配空间：经可写视图写入
+/// @param cache 高速缓存对象
+/// @param data 复制进去的数据：NULL 时填 0
+/// @param sz 大小
+/// @param align 对齐
+/// @return 可执行内存地址
+u8 *cache_alloc(cache_t *cache, u8 *data, size_t sz, u64 align);
+
+/// @brief 在冷区中分配空间：CACHE_SPLIT 关闭时与 cache_alloc 相同
+/// @param cache 高速缓存对象
+/// @param data 复制进去的数据：NULL 时填 0
+/// @param sz 大小
+/// @param align 对齐
+/// @return 可执行内存地址
+u8 *cache_alloc_cold(cache_t *cache, u8 *data, size_t sz, u64 align);
+
 /// @brief 在 cache 中加入新的热代码块
 /// @param cache 高速缓存对象
 /// @param pc 当前热代码块的程序计数器
@@ -289,6 +419,25 @@ u8 *cache_add(cache_t *cache, u64 pc, u8 *code, size_t sz, u64 align);
 /// @return `true or false`是否热代码
 bool cache_hot(cache_t *cache, u64 pc);
 
+/// @brief 把已在可执行内存中的代码登记为 pc 的热代码块
+/// @param cache 高速缓存对象
+/// @param pc 程序计数器
+/// @param code 可执行内存地址：必须在 cache->jitcode 中
+void cache_set(cache_t *cache, u64 pc, u8 *code);
+
+/// @brief 查找快要变热、还没有编译的代码块
+/// @param cache 高速缓存对象
+/// @param pcs 接收代码块 pc 的数组
+/// @param max 最多的个数
+/// @return 找到的个数
+u64 cache_warm(cache_t *cache, u64 *pcs, u64 max);
+
+/// @brief 代码块的执行次数：解释执行时每次进入加一，到 CACHE_HOT_COUNT 为止
+/// @param cache 高速缓存对象
+/// @param pc 代码块起点
+/// @return 次数：没有执行过时为 0
+u64 cache_count(cache_t *cache, u64 pc);
+
 // ============================================================================== //
 // 状态 state
 // ============================================================================== //
@@ -316,16 +465,158 @@ typedef struct {
     u64 gp_regs[num_gp_regs];       // 通用寄存器
     fp_reg_t fp_regs[num_fp_regs];  // 浮点型寄存器
     u64 pc;                         // 程序计数器：程序当前所在位置
+    u64 (*syscall)(void *);         // 系统调用入口：JIT 代码直接调用，参数为 state
+    int (*clock_gettime)(int, void *);      // syscall_clock_gettime：JIT 代码的快速路径
+    int (*gettimeofday)(void *, void *);    // syscall_gettimeofday：JIT 代码的快速路径
+    u32 fcsr;                       // frm 与写入的 fflags：浮点指令产生的异常标志留在 MXCSR 中
+    u32 mxcsr;                      // 客户的 MXCSR：执行主机代码时保存在这里
 } state_t;
 
 // ============================================================================== //
 // 解释器 interperter => interp.c
 // ============================================================================== //
 
+/// 融合乘加是否使用主机的 FMA 指令：运行时检查 CPU，不支持时调用 libm 的 fma
+#ifndef HOST_FMA
+#define HOST_FMA 1
+#endif
+
+/// @brief 主机是否支持 FMA 指令：HOST_FMA 关闭时总是 false
+bool host_has_fma(void);
+
+/// @brief 初始化解释器：按主机 CPU 特性选择指令的实现
+void interp_init(void);
+
+/// @brief 开始执行客户代码：保存主机的 MXCSR，换上客户的舍入方式与异常标志
+/// @param state 状态信息对象
+void fenv_enter(state_t *state);
+
+/// @brief 停止执行客户代码：保存客户的 MXCSR，换回主机的
+/// @param state 状态信息对象
+void fenv_leave(state_t *state);
+
 /// @brief 解释执行代码块
 /// @param state 状态信息对象
 void exec_block_interp(state_t *state);
 
+/// @brief 解释执行一条指令：用于逐条对照
+/// @param state 状态信息对象
+/// @return 是否跳出代码块：否则 pc 已步进到下一条指令
+bool exec_insn_interp(state_t *state);
+
+
+// ============================================================================== //
+// 虚拟文件系统 vfs => vfs.c
+// ============================================================================== //
+
+/// 是否在内存中缓存客户程序只读打开的文件
+#ifndef SYSCALL_VFS
+#define SYSCALL_VFS 0
+#endif
+/// 单个文件的缓存上限：更大的文件直接使用主机 fd
+#define VFS_MAX_FILE (16 * 1024 * 1024)
+/// 缓存总大小上限：超过后新文件不再缓存
+#define VFS_MAX_TOTAL (256 * 1024 * 1024)
+
+/// @brief 缓存的文件内容
+typedef struct vfile {
+    char *path;         // 绝对路径：查找的键
+    u64 hash;           // 路径的哈希值
+    u64 refs;           // 引用计数：缓存表与每个打开的文件各一个
+    int memfd;          // 文件内容所在的 memfd：mmap 时直接映射
+    u8 *data;           // 文件内容的主机地址
+    struct stat st;     // 加载时的文件状态
+    struct vfile *next; // 哈希链表
+} vfile_t;
+
+/// @brief 打开的缓存文件：dup 出来的 fd 共用文件位置
+typedef struct {
+    vfile_t *file;
+    i64 pos;            // 文件位置
+    u64 refs;           // 引用计数：每个客户 fd 一个
+} vopen_t;
+
+/// @brief 只读打开文件：不在缓存中时从主机加载
+/// @param path 路径：相对路径基于当前目录
+/// @return NULL 表示不能缓存，调用方改用主机 fd
+vopen_t *vfs_open(const char *path);
+
+/// @brief 复制打开的文件：共用文件位置
+vopen_t *vfs_dup(vopen_t *vo);
+
+/// @brief 关闭打开的文件
+void vfs_close(vopen_t *vo);
+
+/// @brief 从指定位置读取，不改变文件位置
+/// @return 读取长度
+i64 vfs_pread(vopen_t *vo, void *buf, u64 len, i64 off);
+
+/// @brief 从文件位置读取
+/// @return 读取长度
+i64 vfs_read(vopen_t *vo, void *buf, u64 len);
+
+/// @brief 设置文件位置
+/// @return 新的文件位置或 -errno
+i64 vfs_lseek(vopen_t *vo, i64 off, int whence);
+
+/// @brief 通过主机 fd 写入了文件：丢弃同一文件的缓存
+void vfs_invalidate_inode(u64 dev, u64 ino);
+
+/// @brief 当前目录改变：相对路径需要重新解析
+void vfs_chdir(void);
+
+// ============================================================================== //
+// 文件描述符表 fd => syscall.c
+// ============================================================================== //
+
+/// 客户程序可用的 fd 个数
+#define SYSCALL_FD_MAX 1024
+
+/// 是否缓冲客户程序对 stdout 的写入：默认关闭，主机崩溃时缓冲中的输出由信号处理函数写出
+/// stderr 只经过缓冲区保持与 stdout 的先后顺序，每次写入都立即写出
+#ifndef SYSCALL_OUTBUF
+#define SYSCALL_OUTBUF 0
+#endif
+/// stdout/stderr 缓冲区大小
+#define SYSCALL_OUTBUF_SIZE (64 * 1024)
+
+/// @brief 输出缓冲区：客户程序的 stdout/stderr 各一个
+typedef struct {
+    int host;                       // 写出的主机 fd
+    bool init;                      // 是否已检测终端
+    bool tty;                       // 是否终端：终端遇到换行就刷新
+    bool unbuffered;                // 每次写入都立即写出：用于 stderr
+    bool regular;                   // 是否重定向到普通文件：写出时使 vfs 中同一文件的缓存失效
+    u64 dev, ino;                   // 普通文件的设备号与 inode
+    u64 len;                        // 已缓冲长度
+    char buf[SYSCALL_OUTBUF_SIZE];  // 缓冲数据
+} outbuf_t;
+
+/// 未打开的客户 fd
+#define FD_CLOSED (-1)
+/// 由 vfs 提供内容的客户 fd：主机调用使用时以 EBADF 失败
+#define FD_VFS (-2)
+
+/// @brief 客户 fd 的表项
+typedef struct {
+    int host;           // 主机 fd：FD_CLOSED 表示未打开
+    i8 kind;            // 异步写入检测：0 未检测，1 可以异步写入的普通文件，-1 其他
+    bool dirty;         // 有异步写入：主机文件位置还没有同步到 pos
+    i64 pos;            // 异步写入之后的文件位置
+    u64 stat_gen;       // st 对应的写入代数：与 fdtable_t.write_gen 相同时有效
+    struct stat st;     // 缓存的 fstat 结果
+    outbuf_t *outbuf;   // 写入缓冲：NULL 表示直接写主机 fd
+    vopen_t *vopen;     // 缓存的文件：host 为 FD_VFS
+} fd_t;
+
+/// @brief 客户 fd 表：下标为客户 fd
+typedef struct {
+    fd_t fds[SYSCALL_FD_MAX];
+    outbuf_t outbufs[2];    // stdout/stderr 的缓冲区：dup 出来的 fd 共用
+    outbuf_t *last_out;     // 最近写入的缓冲区：切换到另一个时先刷新，保持输出顺序
+    u64 dirty;              // 有异步写入的 fd 个数
+    u64 write_gen;          // 写入代数：每次可能改变文件状态的写入加 1，使 fstat 缓存失效
+} fdtable_t;
 
 // ============================================================================== //
 // 虚拟机 machine => machine.c
@@ -333,9 +624,10 @@ void exec_block_interp(state_t *state);
 
 /// @brief 虚拟机结构体：src/machine.c
 typedef struct {
-    state_t state;
+    state_t state;      // 必须是第一个成员：系统调用入口由 state 得到虚拟机对象
     mmu_t mmu;
     cache_t *cache;
+    fdtable_t fdt;      // 客户 fd 表
 } machine_t;
 
 /// 执行函数签名
@@ -374,31 +666,258 @@ void machine_setup(machine_t *m, int argc, char *argv[]);
 /// @param m 虚拟机对象
 enum exit_reason_t machine_step(machine_t *m);
 
+// ============================================================================== //
+// 中间表示 ir => ir.c
+// ============================================================================== //
+
+/// 是否在翻译之前优化代码块：常量折叠、复制传播、死代码删除
+#ifndef IR_OPTIMIZE
+#define IR_OPTIMIZE 1
+#endif
+
+/// 是否把栈帧中的读写提升为主机局部变量
+#ifndef IR_PROMOTE_SLOTS
+#define IR_PROMOTE_SLOTS 1
+#endif
+
+/// 代码块最多的指令数：放不下的跳转目标变成跳出代码块
+#define IR_MAX_INSNS 8192
+
+/// 代码块最多的栈槽数：avail 的位数
+#define IR_MAX_SLOTS 64
+
+/// 跳转一边的执行次数不到另一边的 1/IR_COLD_RATIO 时，那一边是冷的
+#define IR_COLD_RATIO 16
+
+/// @brief IR 指令种类
+enum ir_kind_t {
+    ir_insn,    // 原指令：寄存器与立即数可能已被优化改写
+    ir_li,      // insn.rd = val
+    ir_mv,      // insn.rd = insn.rs1
+    ir_nop,     // 什么也不做，顺序执行
+    ir_exit,    // 跳出代码块：原因为 reason，从 val 继续执行
+};
+
+/// @brief 代码块中的一条 IR 指令
+typedef struct {
+    u64 pc;
+    insn_t insn;            // 解码结果：insn.len 给出指令长度
+    enum ir_kind_t kind;
+    u64 val;                // ir_li 的常量，ir_exit 的 pc，ecall 处已知的 a7
+    enum exit_reason_t reason;
+    i32 next;               // 顺序执行的下一条指令下标：-1 表示没有
+    bool leader;            // 基本块的第一条指令：跳转目标、调用返回地址等
+    bool known;             // ecall：val 为 a7 的已知值
+    i8 slot;                // 读写的栈槽：-1 表示不是栈槽
+    u64 avail;              // 执行前局部变量与内存一致的栈槽
+    bool cold;              // 很少执行：后端把它放到热代码之外
+} ir_insn_t;
+
+/// @brief 栈槽：base 寄存器加 off 处 size 字节的内存
+typedef struct {
+    i8 base;
+    i32 off;
+    u8 size;
+} ir_slot_t;
+
+/// @brief 发现 start 开始的代码块并优化
+/// @param start 代码块起点 pc
+/// @param max 最多的指令数：不超过 IR_MAX_INSNS
+/// @param trace 是否沿直接跳转展开：false 时与解释器的代码块相同，跳转与 ecall 之后结束
+/// @param cache 解释执行的次数：用于标记冷的指令
+/// @param n 接收指令数
+/// @return IR 指令数组：第一条是 start，下一次调用前有效
+ir_insn_t *ir_build(u64 start, u64 max, bool trace, cache_t *cache, u64 *n);
+
+/// ir_operands 的结果：指令读写的寄存器字段
+enum { IR_USE_RS1 = 1, IR_USE_RS2 = 2, IR_DEF_RD = 4 };
+
+/// @brief 指令读写的寄存器：ecall 与 RV64IM 以外的指令另外处理，返回 0
+int ir_operands(ir_insn_t *e);
+
+/// @brief 最近一次 ir_build 的代码块中 pc 处指令的下标
+/// @return 下标：不在代码块中时返回 -1
+i32 ir_find(u64 pc);
+
+/// @brief 最近一次 ir_build 的代码块中 pc 处的指令是否是冷的
+/// @return 不在代码块中时返回 false
+bool ir_cold(u64 pc);
+
+/// @brief 最近一次 ir_build 的代码块中的栈槽：都以同一个寄存器为基址
+/// @param n 接收栈槽数
+ir_slot_t *ir_slots(u64 *n);
+
+/// @brief mask 中的栈槽覆盖的偏移范围 [lo, hi)
+void ir_slots_range(u64 mask, i64 *lo, i64 *hi);
+
+/// @brief 输出 IR 优化统计：TEMU_STATS 时在退出时调用
+void ir_report(void);
+
 // ============================================================================== //
 // 代码生成 codegen => codegen.c
 // ============================================================================== //
 
-/// @brief 虚拟机生成中间代码
+/// 一次 clang 调用最多编译的代码块数：分摊进程启动的开销
+#ifndef COMPILE_BATCH
+#define COMPILE_BATCH 8
+#endif
+
+/// 一个代码块最多登记的入口数
+#define CODEGEN_MAX_ENTRIES 256
+
+/// 是否把代码块中的自然循环生成 for (;;)：循环体中间不再作为入口
+#ifndef CODEGEN_LOOPS
+#define CODEGEN_LOOPS 1
+#endif
+
+/// @brief 代码块的入口：代码块起点，以及块内的跳转目标、调用返回地址
+typedef struct {
+    u64 n;
+    u64 pcs[CODEGEN_MAX_ENTRIES];
+} entries_t;
+
+/// @brief 虚拟机生成中间代码：每个代码块生成一个函数 block_<pc>，按 state->reenter_pc 进入
 /// @param m 虚拟机对象
+/// @param pcs 代码块起点 pc
+/// @param n 代码块个数
+/// @param entries 接收每个代码块的入口
 /// @return `str_t` 类型 C 中间代码
-str_t machine_genblock(machine_t *m);
+str_t machine_genblock(machine_t *m, u64 *pcs, u64 n, entries_t *entries);
 
 // ============================================================================== //
 // 编译 compile => compile.c
 // ============================================================================== //
 
-/// @brief 虚拟机编译中间代码
+/// @brief 虚拟机编译中间代码，并把每个代码块的入口登记到高速缓存
 /// @param m 虚拟机对象
 /// @param str 中间代码
-/// @return 可执行内存地址
-u8 *machine_compile(machine_t *m, str_t str);
+/// @param entries 每个代码块的入口：与 machine_genblock 相同
+/// @param n 代码块个数
+/// @return 第一个代码块的可执行内存地址
+u8 *machine_compile(machine_t *m, str_t str, entries_t *entries, u64 n);
+
+/// @brief 把编译得到的 ELF 目标文件链接进高速缓存：加载所有 SHF_ALLOC section 并重定位
+/// @param m 虚拟机对象
+/// @param elf 目标文件内容
+/// @param size 目标文件大小
+void machine_link(machine_t *m, u8 *elf, u64 size);
+
+/// @brief 查找最近一次 machine_link 链接的符号
+/// @param elf 目标文件内容：与 machine_link 相同
+/// @param name 符号名
+/// @return 链接后的地址：找不到时返回 NULL
+u8 *machine_symbol(u8 *elf, const char *name);
+
+// ============================================================================== //
+// LLVM 编译 llvm => llvm.c
+// ============================================================================== //
+
+/// 是否用 LLVM 在进程内编译热代码块：`make LLVM=1` 时打开
+#ifndef COMPILE_LLVM
+#define COMPILE_LLVM 0
+#endif
+
+/// LLVM 优化流水线：与 opt -passes 的写法相同
+#ifndef LLVM_PASSES
+#define LLVM_PASSES "default<O2>"
+#endif
+
+/// @brief 把当前 pc 开始的代码块翻译成 LLVM IR 并在进程内编译
+/// @param m 虚拟机对象
+/// @return 可执行内存地址：有不支持的指令或未启用 LLVM 时返回 NULL
+u8 *machine_llvm(machine_t *m);
+
+/// @brief 输出 LLVM 编译统计：TEMU_STATS 时在退出时调用
+void llvm_report(void);
+
+// ============================================================================== //
+// 本地代码生成 emit => emit.c
+// ============================================================================== //
+
+/// 是否直接生成 x86-64 机器码：只含 RV64IM 指令的代码块不再经过 clang
+#ifndef EMIT_NATIVE
+#define EMIT_NATIVE 0
+#endif
+
+/// 是否逐块与解释器比较本地代码的执行结果：不一致时报错退出
+#ifndef EMIT_VERIFY
+#define EMIT_VERIFY 0
+#endif
+
+/// 本地代码块最多的指令数：超过时交给 clang
+#define EMIT_MAX_INSNS 2048
+
+/// @brief 把当前 pc 开始的代码块直接翻译成 x86-64 机器码
+/// @param m 虚拟机对象
+/// @return 可执行内存地址：有不支持的指令时返回 NULL
+u8 *machine_emit(machine_t *m);
+
+/// @brief 是否为 machine_emit 生成的代码块：EMIT_VERIFY 时有效
+bool emit_is_native(u8 *code);
+
+/// @brief 执行本地代码块，并与解释器的结果比较
+/// @param m 虚拟机对象
+/// @param code 本地代码块
+void emit_verify(machine_t *m, u8 *code);
+
+/// @brief 输出本地代码生成统计：TEMU_STATS 时在退出时调用
+void emit_report(void);
 
 // ============================================================================== //
 // 系统调用 syscall => syscall.c
 // ============================================================================== //
 
+/// 是否用 io_uring 异步写入普通文件
+#ifndef SYSCALL_URING
+#define SYSCALL_URING 0
+#endif
+
+/// @brief 初始化客户 fd 表：fd 0/1/2 对应主机的标准输入输出
+/// @param m 虚拟机对象
+void syscall_setup(machine_t *m);
+
 /// @brief 执行系统调用
 /// @param m 虚拟机对象
 /// @param n 系统调用编号
 /// @return 系统调用返回地址
 u64 do_syscall(machine_t *m, u64 n);
+
+/// @brief JIT 代码的系统调用入口：系统调用编号在 a7，返回值由调用方写入 a0
+/// @param state 状态信息对象：即 machine_t 的第一个成员
+/// @return 系统调用返回值
+u64 syscall_trampoline(void *state);
+
+/// @brief JIT 代码快速路径的 clock_gettime：直接调用主机函数，失败时返回 -errno，TEMU_STATS 时计数
+int syscall_clock_gettime(int clockid, void *tp);
+
+/// @brief JIT 代码快速路径的 gettimeofday：失败时返回 -errno，TEMU_STATS 时计数
+int syscall_gettimeofday(void *tv, void *tz);
+
+/// @brief 刷新 stdout/stderr 缓冲区：退出前调用
+/// @param m 虚拟机对象
+void syscall_flush(machine_t *m);
+
+/// @brief 按累计主机耗时输出每个系统调用的调用次数与耗时：TEMU_STATS 时退出前调用
+void syscall_report(void);
+
+// ============================================================================== //
+// 异步 I/O uring => uring.c
+// ============================================================================== //
+
+/// io_uring 队列长度：同时在途的异步写入上限
+#define URING_ENTRIES   64
+/// 攒够多少个请求提交一次
+#define URING_BATCH     8
+/// 超过该长度的写入同步完成
+#define URING_MAX_WRITE (1024 * 1024)
+
+/// @brief 异步写入：拷贝数据后排队提交
+/// @param fd 主机文件描述符
+/// @param data 数据
+/// @param len 数据长度
+/// @param offset 文件偏移量
+/// @return `false` 表示 io_uring 不可用，调用方需要同步写入
+bool uring_write(int fd, const void *data, u64 len, i64 offset);
+
+/// @brief 提交所有排队的请求并等待全部完成
+void uring_drain(void);
@@ -0,0 +1,140 @@
+/**
+ * \file src/uring.c
+ * \brief 异步 I/O：基于 io_uring 提交客户程序的文件写入
+ */
+
+#include "temu.h"
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+
+/// @brief io_uring 环形队列
+typedef struct {
+    int fd;                         // io_uring 文件描述符：-1 表示不可用
+    u32 *sq_head, *sq_tail, *sq_mask, *sq_array;
+    u32 *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;      // 提交队列项
+    struct io_uring_cqe *cqes;      // 完成队列项
+    u32 queued;                     // 已放入提交队列但还未提交的个数
+    u32 inflight;                   // 已提交但还未完成的个数
+    void *bufs[URING_ENTRIES];      // 每个提交队列项对应的数据拷贝
+} uring_t;
+
+static uring_t ring = { .fd = -1 };
+static bool ring_tried = false;
+
+/// @brief 初始化 io_uring：失败时保持 fd = -1，调用方退回同步 I/O
+static void uring_setup(void) {
+    ring_tried = true;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+    if (fd < 0) return;
+
+    u64 sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+    u64 cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) sq_size = cq_size = MAX(sq_size, cq_size);
+
+    u8 *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_SQ_RING);
+    u8 *cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+        cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+
+    ring.sq_head = (u32 *)(sq + p.sq_off.head);
+    ring.sq_tail = (u32 *)(sq + p.sq_off.tail);
+    ring.sq_mask = (u32 *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (u32 *)(sq + p.sq_off.array);
+    ring.cq_head = (u32 *)(cq + p.cq_off.head);
+    ring.cq_tail = (u32 *)(cq + p.cq_off.tail);
+    ring.cq_mask = (u32 *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring.sqes = sqes;
+    ring.fd = fd;
+}
+
+/// @brief 提交已排队的请求，并等待至少 wait 个请求完成
+/// @param wait 需要等待完成的个数
+static void uring_enter(u32 wait) {
+    int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    while (true) {
+        int n = syscall(__NR_io_uring_enter, ring.fd, ring.queued, wait, flags, NULL, 0);
+        if (n >= 0) {
+            ring.inflight += n;
+            ring.queued -= n;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            fatal(strerror(errno));
+    }
+}
+
+/// @brief 回收已完成的请求：释放数据拷贝，报告写入错误
+static void uring_reap(void) {
+    u32 head = *ring.cq_head;
+    u32 tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        u32 slot = (u32)cqe->user_data;
+        if (cqe->res < 0)
+            fprintf(stderr, "warning: async write failed: %s\n", strerror(-cqe->res));
+        free(ring.bufs[slot]);
+        ring.bufs[slot] = NULL;
+        ring.inflight--;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+bool uring_write(int fd, const void *data, u64 len, i64 offset) {
+    if (!ring_tried) uring_setup();
+    if (ring.fd < 0 || len > URING_MAX_WRITE) return false;
+
+    // 队列满了：先等一个请求完成
+    while (ring.queued + ring.inflight >= URING_ENTRIES) {
+        uring_enter(1);
+        uring_reap();
+    }
+
+    // 找一个空闲的数据槽位
+    u32 slot = 0;
+    while (ring.bufs[slot] != NULL) slot++;
+    void *copy = malloc(len);
+    if (copy == NULL) return false;
+    memcpy(copy, data, len);    // 系统调用返回后客户程序可以改写缓冲区
+    ring.bufs[slot] = copy;
+
+    u32 tail = *ring.sq_tail;
+    u32 index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (u64)copy;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.queued++;
+
+    // 攒够一批再提交，减少 io_uring_enter 次数
+    if (ring.queued >= URING_BATCH) uring_enter(0);
+    uring_reap();
+    return true;
+}
+
+void uring_drain(void) {
+    if (ring.fd < 0) return;
+    while (ring.queued + ring.inflight > 0) {
+        uring_enter(ring.queued + ring.inflight);
+        uring_reap();
+    }
+}
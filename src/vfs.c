@@ -0,0 +1,175 @@
+/**
+ * \file src/vfs.c
+ * \brief 虚拟文件系统：在内存中缓存客户程序只读打开的文件
+ */
+
+#include "temu.h"
+
+#include <asm/unistd.h>
+#include <limits.h>
+#include <linux/memfd.h>
+
+/// 哈希桶个数
+#define VFS_BUCKETS 1024
+
+static vfile_t *buckets[VFS_BUCKETS];
+static u64 vfs_total = 0;   // 已缓存的总大小
+static u64 vfs_count = 0;   // 已缓存的文件个数
+static char vfs_cwd[PATH_MAX];
+
+/// @brief FNV-1a 哈希
+static u64 vfs_hash(const char *s) {
+    u64 h = 0xcbf29ce484222325ul;
+    for (; *s; s++) h = (h ^ (u8)*s) * 0x100000001b3ul;
+    return h;
+}
+
+/// @brief 得到查找用的绝对路径
+/// @return 是否成功：路径过长时不缓存
+static bool vfs_key(const char *path, char *key) {
+    if (path[0] == '/') {
+        if (strlen(path) >= PATH_MAX) return false;
+        strcpy(key, path);
+        return true;
+    }
+    if (vfs_cwd[0] == '\0' && getcwd(vfs_cwd, sizeof(vfs_cwd)) == NULL) return false;
+    return snprintf(key, PATH_MAX, "%s/%s", vfs_cwd, path) < PATH_MAX;
+}
+
+/// @brief 释放一个引用：最后一个引用释放文件内容
+static void vfile_put(vfile_t *f) {
+    if (--f->refs) return;
+    if (f->data) munmap(f->data, f->st.st_size);
+    close(f->memfd);
+    free(f->path);
+    free(f);
+}
+
+/// @brief 从缓存表中移除
+static void vfile_remove(vfile_t **link) {
+    vfile_t *f = *link;
+    *link = f->next;
+    vfs_total -= f->st.st_size;
+    vfs_count--;
+    vfile_put(f);
+}
+
+/// @brief 把主机文件读入 memfd
+/// @return NULL 表示不能缓存：不存在、不是普通文件或太大
+static vfile_t *vfile_load(const char *key, u64 hash) {
+    int fd = open(key, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size > VFS_MAX_FILE ||
+        vfs_total + st.st_size > VFS_MAX_TOTAL) {
+        close(fd);
+        return NULL;
+    }
+
+    int memfd = syscall(__NR_memfd_create, "temu-vfs", MFD_CLOEXEC);
+    u8 *data = NULL;
+    if (memfd < 0 || ftruncate(memfd, st.st_size) < 0) goto fail;
+    if (st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (data == MAP_FAILED) {
+            data = NULL;
+            goto fail;
+        }
+    }
+    for (i64 done = 0; done < st.st_size;) {
+        ssize_t n = pread(fd, data + done, st.st_size - done, done);
+        if (n <= 0) goto fail;      // 文件在加载时被截断
+        done += n;
+    }
+    close(fd);
+
+    vfile_t *f = calloc(1, sizeof(vfile_t));
+    f->path = strdup(key);
+    f->hash = hash;
+    f->refs = 1;
+    f->memfd = memfd;
+    f->data = data;
+    f->st = st;
+    vfile_t **bucket = &buckets[hash % VFS_BUCKETS];
+    f->next = *bucket;
+    *bucket = f;
+    vfs_total += st.st_size;
+    vfs_count++;
+    return f;
+
+fail:
+    if (data) munmap(data, st.st_size);
+    if (memfd >= 0) close(memfd);
+    close(fd);
+    return NULL;
+}
+
+vopen_t *vfs_open(const char *path) {
+    char key[PATH_MAX];
+    if (!vfs_key(path, key)) return NULL;
+    u64 hash = vfs_hash(key);
+
+    vfile_t *f = buckets[hash % VFS_BUCKETS];
+    while (f && (f->hash != hash || strcmp(f->path, key) != 0)) f = f->next;
+    if (!f && !(f = vfile_load(key, hash))) return NULL;
+
+    vopen_t *vo = malloc(sizeof(vopen_t));
+    vo->file = f;
+    vo->pos = 0;
+    vo->refs = 1;
+    f->refs++;
+    return vo;
+}
+
+vopen_t *vfs_dup(vopen_t *vo) {
+    vo->refs++;
+    return vo;
+}
+
+void vfs_close(vopen_t *vo) {
+    if (--vo->refs) return;
+    vfile_put(vo->file);
+    free(vo);
+}
+
+i64 vfs_pread(vopen_t *vo, void *buf, u64 len, i64 off) {
+    i64 size = vo->file->st.st_size;
+    if (off >= size) return 0;
+    len = MIN(len, (u64)(size - off));
+    memcpy(buf, vo->file->data + off, len);
+    return len;
+}
+
+i64 vfs_read(vopen_t *vo, void *buf, u64 len) {
+    i64 n = vfs_pread(vo, buf, len, vo->pos);
+    vo->pos += n;
+    return n;
+}
+
+i64 vfs_lseek(vopen_t *vo, i64 off, int whence) {
+    i64 pos;
+    switch (whence) {
+    case SEEK_SET: pos = off; break;
+    case SEEK_CUR: pos = vo->pos + off; break;
+    case SEEK_END: pos = vo->file->st.st_size + off; break;
+    default: return -EINVAL;
+    }
+    if (pos < 0) return -EINVAL;
+    vo->pos = pos;
+    return pos;
+}
+
+void vfs_invalidate_inode(u64 dev, u64 ino) {
+    for (u64 i = 0; i < VFS_BUCKETS && vfs_count; i++) {
+        vfile_t **link = &buckets[i];
+        while (*link) {
+            if ((*link)->st.st_dev == dev && (*link)->st.st_ino == ino) vfile_remove(link);
+            else link = &(*link)->next;
+        }
+    }
+}
+
+void vfs_chdir(void) {
+    vfs_cwd[0] = '\0';
+}